@@ -19,44 +19,67 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <util/atomic.h>
-void initAnalogPins(uint8_t bitmask) {
-	DDRC &= ~bitmask;
-	PORTC &= ~bitmask;
-
-	// enable a2d conversions, interrupt on completion
-	ADCSRA |= _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0) |
-			_BV(ADEN) | _BV(ADIE);
-
-}
-
-volatile int16_t* adc_destination;
-volatile bool* adc_finished;
 
 // We are using the AVcc as our reference.  There's a 100nF cap
 // to ground on the AREF pin.
 const uint8_t ANALOG_REF = 0x01;
 
+/// Number of conversions summed for each reading
+#define OVERSAMPLE_COUNT (1 << (2*ANALOG_FRACTION_BITS))
+
+/// Pins being scanned
+uint8_t scan_mask = 0;
+/// Pin being converted
+uint8_t scan_pin = 0;
+/// Sum of the conversions of scan_pin so far
+uint16_t scan_sum;
+/// Conversions of scan_pin so far.  The first conversion after switching
+/// pins is thrown away, while the input settles.
+int8_t scan_count;
+/// The latest reading of each pin
+volatile int16_t readings[8];
+/// Pins with a reading
+volatile uint8_t readings_valid = 0;
+
+/// Switch the multiplexer to the given pin and start converting it.
+void startPin(uint8_t pin) {
+	scan_pin = pin;
+	scan_sum = 0;
+	scan_count = -1;
+	// set the analog reference (high two bits of ADMUX) and select the
+	// channel (low 4 bits).  this also sets ADLAR (left-adjust result)
+	// to 0 (the default).
+	ADMUX = (ANALOG_REF << 6) | (pin & 0x0f);
+	// start the conversion.
+	ADCSRA |= _BV(ADSC);
+}
+
+void initAnalogPins(uint8_t bitmask) {
+	DDRC &= ~bitmask;
+	PORTC &= ~bitmask;
 
-bool startAnalogRead(uint8_t pin, volatile int16_t* destination, volatile bool* finished) {
-	// ADSC is cleared when the conversion finishes.
-	// We should not start a new read while an existing one is in progress.
-	if ((ADCSRA & _BV(ADSC)) != 0) {
-		return false;
-	}
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		adc_destination = destination;
-		adc_finished = finished;
-		*adc_finished = false;
+		const bool running = scan_mask != 0;
+		scan_mask |= bitmask;
+		readings_valid &= ~bitmask;
+		if (!running) {
+			// enable a2d conversions, interrupt on completion
+			ADCSRA |= _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0) |
+					_BV(ADEN) | _BV(ADIE);
+			uint8_t pin = 0;
+			while ((scan_mask & _BV(pin)) == 0) { pin++; }
+			startPin(pin);
+		}
+	}
+}
 
-		// set the analog reference (high two bits of ADMUX) and select the
-		// channel (low 4 bits).  this also sets ADLAR (left-adjust result)
-		// to 0 (the default).
-		ADMUX = (ANALOG_REF << 6) | (pin & 0x0f);
-		// start the conversion.
-		ADCSRA |= _BV(ADSC);
+bool getAnalogReading(uint8_t pin, int16_t& value) {
+	bool valid;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		valid = (readings_valid & _BV(pin)) != 0;
+		value = readings[pin];
 	}
-	// An interrupt will signal conversion completion.
-	return true;
+	return valid;
 }
 
 ISR(ADC_vect)
@@ -69,8 +92,20 @@ ISR(ADC_vect)
 	low_byte = ADCL;
 	high_byte = ADCH;
 
-	// combine the two bytes
-	*adc_destination = (high_byte << 8) | low_byte;
-	*adc_finished = true;
+	if (scan_count >= 0) {
+		scan_sum += (high_byte << 8) | low_byte;
+	}
+	if (++scan_count < OVERSAMPLE_COUNT) {
+		ADCSRA |= _BV(ADSC);
+		return;
+	}
+	// Summing 4^n conversions and dividing by 2^n gives n more bits.
+	readings[scan_pin] = scan_sum >> ANALOG_FRACTION_BITS;
+	readings_valid |= _BV(scan_pin);
+	// Go on to the next pin being scanned.
+	uint8_t pin = scan_pin;
+	do {
+		pin = (pin + 1) & 0x07;
+	} while ((scan_mask & _BV(pin)) == 0);
+	startPin(pin);
 }
-
@@ -20,9 +20,17 @@
 
 #include <stdint.h>
 
+/// Readings have this many bits below the ADC's 10, from oversampling.
+#define ANALOG_FRACTION_BITS 2
+
+/// Start converting the pins in the given mask, as well as any already
+/// started.  The ADC interrupt works through the pins in turn, summing
+/// several conversions of each for a reading with extra resolution and
+/// less noise.
 void initAnalogPins(uint8_t bitmask);
 
-// True if initiated, false if busy
-bool startAnalogRead(uint8_t pin, volatile int16_t* destination, volatile bool* finished);
+/// Get the latest reading of the given pin, in 1/(2^ANALOG_FRACTION_BITS)
+/// ADC counts.  False if the pin hasn't been read since it was started.
+bool getAnalogReading(uint8_t pin, int16_t& value);
 
 #endif /* BOARDS_ECV22_ANALOG_PIN_HH_ */
@@ -103,6 +103,9 @@ enum {
 	EF_ABP_MOTOR_0			= 1 << 6,
 	EF_ABP_MOTOR_1			= 1 << 7,
 
+	// Heat up using the learned thermal model (see HeaterModel.hh)
+	EF_HEATER_MODEL			= 1 << 8,
+
 	// These are necessary to deal with horrible "all 0/all 1" problems
 	// we introduced back in the day
 	EF_ACTIVE_0				= 1 << 14,  // Set to 1 if EF word is valid
@@ -114,6 +117,17 @@ const static uint16_t EF_DEFAULT = 0x4084;
 /// Extruder identifier; defaults to 0: 1 byte
 const static uint16_t SLAVE_ID					= 0x001a;
 
+/// Extruder heater thermal model (see HeaterModel.hh): heating rate,
+/// loss (2 bytes each) and dead time (1 byte)
+const static uint16_t EXTRUDER_HEATER_MODEL		= 0x001c;
+/// HBP heater thermal model, laid out as above
+const static uint16_t HBP_HEATER_MODEL			= 0x0022;
+
+/// Length of the HBP heater's time-proportioned output window, in tenths of
+/// a second, or 0 to switch it on whenever the PID output is non-zero:
+/// 1 byte
+const static uint16_t HBP_PWM_WINDOW			= 0x0028;
+
 const static uint16_t THERM_R0_OFFSET			= 0x00;
 const static uint16_t THERM_T0_OFFSET			= 0x04;
 const static uint16_t THERM_BETA_OFFSET			= 0x08;
@@ -129,7 +143,10 @@ void init();
 
 uint8_t getEeprom8(const uint16_t location, const uint8_t default_value);
 uint16_t getEeprom16(const uint16_t location, const uint16_t default_value);
-float getEepromFixed16(const uint16_t location, const float default_value);
+/// Read an 8.8 fixed-point value: the integer part, then the fraction in
+/// 256ths.  Returns the value as a uint16_t with the same layout as PID
+/// gains (see PID.hh).
+uint16_t getEepromFixed16(const uint16_t location, const uint16_t default_value);
 
 } // namespace eeprom
 
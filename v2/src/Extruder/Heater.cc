@@ -21,10 +21,11 @@
 #include "Thermistor.hh"
 #include "ExtruderBoard.hh"
 #include "EepromMap.hh"
+#include <avr/eeprom.h>
 
-#define DEFAULT_P 7.0
-#define DEFAULT_I 0.325
-#define DEFAULT_D 36.0
+#define DEFAULT_P PID_FIXED(7.0)
+#define DEFAULT_I PID_FIXED(0.325)
+#define DEFAULT_D PID_FIXED(36.0)
 
 // Offset to compensate for range clipping and bleed-off
 #define HEATER_OFFSET_ADJUSTMENT 0
@@ -33,11 +34,55 @@
 //             current temperature, bypass the PID loop altogether.
 #define PID_BYPASS_DELTA 15
 
+// We now define target hysteresis in absolute degrees.  The original
+// implementation (+/-5%) was giving us swings of 10% in either direction
+// *before* any artifacts of process instability came in.
+#define TARGET_HYSTERESIS 2
+
+// Model heat-up: the temperature is taken to have peaked once it hasn't
+// risen for this many updates.
+#define MODEL_PEAK_UPDATES 20
+
+// Autotune: the relay switches this many degrees either side of the
+// target, to keep sensor noise from chattering it.
+#define AUTOTUNE_HYSTERESIS 1
+// Full oscillations measured; the first one, still settling from the
+// warmup, is not counted.
+#define AUTOTUNE_CYCLES 3
+// Give up if the tune takes longer than this many PID updates (40 minutes)
+#define AUTOTUNE_MAX_UPDATES 4800
+// or overshoots the target by this many degrees.
+#define AUTOTUNE_MAX_OVERSHOOT 40
+
+/// State of the relay autotune.  A cycle runs from one switch-on of the
+/// relay to the next.
+struct Autotune {
+	Heater* heater;
+	uint8_t state;
+	bool heating;
+	int setpoint;
+	/// PID updates since the tune started
+	uint16_t updates;
+	/// Switch-ons seen so far
+	uint8_t switches;
+	uint16_t cycle_start;
+	int high;
+	int low;
+	/// Totals over the measured cycles
+	uint16_t period_sum;
+	uint16_t swing_sum;
+	uint16_t p, i, d;
+};
+
+Autotune autotune;
+
 Heater::Heater(TemperatureSensor& sensor_in, HeatingElement& element_in, micros_t sample_interval_micros_in, uint16_t eeprom_base_in) :
 		sensor(sensor_in),
 		element(element_in),
 		sample_interval_micros(sample_interval_micros_in),
-		eeprom_base(eeprom_base_in)
+		eeprom_base(eeprom_base_in),
+		output(0),
+		eeprom_length(0)
 {
 	if (eeprom_base == 0) { eeprom_base = eeprom::EXTRUDER_PID_P_TERM; }
 
@@ -46,15 +91,21 @@ Heater::Heater(TemperatureSensor& sensor_in, HeatingElement& element_in, micros_
 
 #define I_OFFSET (eeprom::EXTRUDER_PID_I_TERM - eeprom::EXTRUDER_PID_P_TERM)
 #define D_OFFSET (eeprom::EXTRUDER_PID_D_TERM - eeprom::EXTRUDER_PID_P_TERM)
+#define MODEL_OFFSET (eeprom::EXTRUDER_HEATER_MODEL - eeprom::EXTRUDER_PID_P_TERM)
 
 void Heater::reset() {
+	if (autotune.heater == this && autotune.state == AUTOTUNE_RUNNING) {
+		autotune.state = AUTOTUNE_IDLE;
+	}
+	// The settings are read back below.
+	flush_eeprom();
 	current_temperature = 0;
 
 	fail_state = false;
 
-	float p = eeprom::getEepromFixed16(eeprom_base,DEFAULT_P);
-	float i = eeprom::getEepromFixed16(eeprom_base+I_OFFSET,DEFAULT_I);
-	float d = eeprom::getEepromFixed16(eeprom_base+D_OFFSET,DEFAULT_D);
+	uint16_t p = eeprom::getEepromFixed16(eeprom_base,DEFAULT_P);
+	uint16_t i = eeprom::getEepromFixed16(eeprom_base+I_OFFSET,DEFAULT_I);
+	uint16_t d = eeprom::getEepromFixed16(eeprom_base+D_OFFSET,DEFAULT_D);
 
 	pid.reset();
 	if (p == 0 && i == 0 && d == 0) {
@@ -64,20 +115,34 @@ void Heater::reset() {
 	pid.setIGain(i);
 	pid.setDGain(d);
 	pid.setTarget(0);
+
+	const uint16_t ef = eeprom::getEeprom16(eeprom::EXTRA_FEATURES,eeprom::EF_DEFAULT);
+	using_model = (ef & eeprom::EF_HEATER_MODEL) != 0;
+	model.load(eeprom_base+MODEL_OFFSET);
+	model_phase = MODEL_HOLDING;
+
 	next_pid_timeout.start(UPDATE_INTERVAL_MICROS);
 	next_sense_timeout.start(sample_interval_micros);
 }
 
 void Heater::set_target_temperature(int temp)
 {
+	if (autotune.heater == this && autotune.state == AUTOTUNE_RUNNING) {
+		autotune.state = AUTOTUNE_IDLE;
+	}
+	if (using_model && temp != pid.getTarget()) {
+		if (temp > current_temperature + TARGET_HYSTERESIS) {
+			model_phase = MODEL_HEATING;
+			model_updates = 0;
+			model_windows = 0;
+			model_temp = current_temperature;
+		} else {
+			model_phase = MODEL_HOLDING;
+		}
+	}
 	pid.setTarget(temp);
 }
 
-// We now define target hysteresis in absolute degrees.  The original
-// implementation (+/-5%) was giving us swings of 10% in either direction
-// *before* any artifacts of process instability came in.
-#define TARGET_HYSTERESIS 2
-
 bool Heater::has_reached_target_temperature()
 {
 	return (current_temperature >= (pid.getTarget() - TARGET_HYSTERESIS)) &&
@@ -114,10 +179,11 @@ int Heater::getPIDLastOutput() {
  o If temp is too low, don't start the motor
  o Adjust the heater power to keep the temperature at the target
  */
-void Heater::manage_temperature()
+bool Heater::manage_temperature()
 {
+	write_eeprom_byte();
 	if (fail_state) {
-		return;
+		return false;
 	}
 
 	if (next_sense_timeout.hasElapsed()) {
@@ -125,14 +191,14 @@ void Heater::manage_temperature()
 		switch (sensor.update()) {
 		case TemperatureSensor::SS_ADC_BUSY:
 		case TemperatureSensor::SS_ADC_WAITING:
-			return;
+			return false;
 			break;
 		case TemperatureSensor::SS_OK:
 			break;
 		case TemperatureSensor::SS_ERROR_UNPLUGGED:
 		default:
 			fail();
-			return;
+			return true;
 			break;
 		}
 		next_sense_timeout.start(sample_interval_micros);
@@ -142,6 +208,16 @@ void Heater::manage_temperature()
 		// update the temperature reading.
 		current_temperature = get_current_temperature();
 
+		if (autotune.heater == this && autotune.state == AUTOTUNE_RUNNING) {
+			autotune_step();
+			return true;
+		}
+
+		if (using_model) {
+			set_output(model_output());
+			return true;
+		}
+
 		int delta = pid.getTarget() - current_temperature;
 
 		if( bypassing_PID && (delta < PID_BYPASS_DELTA) ) {
@@ -168,16 +244,113 @@ void Heater::manage_temperature()
 			if (pid.getTarget() == 0) { mv = 0; }
 			set_output(mv);
 		}
+		return true;
 	}
+	return false;
+}
+
+/// Work out the output for this update from the thermal model.  Heat-ups
+/// run at full power until the temperature, plus the rise the model
+/// predicts after cutting the power, reaches the target.  The heater then
+/// coasts on the power the model says holds the target, and the PID takes
+/// over, on top of that power, once the temperature peaks.  Each heat-up
+/// refines the model.
+uint8_t Heater::model_output()
+{
+	const int target = pid.getTarget();
+	const int temp = current_temperature;
+	if (target == 0) {
+		return 0;
+	}
+	const uint8_t feed_forward = model.feedForward(target);
+	switch (model_phase) {
+	case MODEL_HEATING:
+	{
+		if (++model_updates == MODEL_RATE_WINDOW) {
+			const int rise = temp - model_temp;
+			const int middle = (temp + model_temp) / 2;
+			// The first window is held back by the dead time.
+			if (rise > 0 && rise < 0x100 && model_windows < 0xff) {
+				if (++model_windows >= 2) {
+					model.learnRate(rise, middle);
+				}
+				if (model_windows == 2) {
+					model_first_rise = rise;
+					model_first_temp = middle;
+				}
+				model_last_rise = rise;
+				model_last_temp = middle;
+			}
+			model_updates = 0;
+			model_temp = temp;
+		}
+		int coast = model.coast(temp);
+		// Until the model is learned, hand over where the bypass would.
+		if (coast < 0) { coast = PID_BYPASS_DELTA; }
+		if (temp + coast < target) {
+			return 255;
+		}
+		if (model_windows > 2) {
+			model.learnHeatup(model_first_rise, model_first_temp,
+					model_last_rise, model_last_temp);
+		}
+		model_phase = MODEL_COASTING;
+		model_updates = 0;
+		model_peak_at = 0;
+		model_temp = temp;
+		return feed_forward;
+	}
+	case MODEL_COASTING:
+		model_updates++;
+		if (temp > model_temp) {
+			model_temp = temp;
+			model_peak_at = model_updates;
+		} else if (model_updates - model_peak_at >= MODEL_PEAK_UPDATES ||
+				model_updates == 0xff) {
+			model.learnDeadTime(model_peak_at);
+			model.save(start_eeprom_write(eeprom_base+MODEL_OFFSET,
+					HeaterModel::SAVED_SIZE));
+			pid.reset_state();
+			model_phase = MODEL_SETTLING;
+			model_updates = 0;
+			model_output_sum = 0;
+		}
+		return feed_forward;
+	default:
+		break;
+	}
+
+	int mv = pid.calculate(temp) + feed_forward;
+	if (mv < 0) { mv = 0; }
+	if (mv > 255) { mv = 255; }
+	if (model_phase == MODEL_SETTLING) {
+		if (temp - target > 1 || target - temp > 1) {
+			model_updates = 0;
+			model_output_sum = 0;
+		} else {
+			model_output_sum += mv;
+			if (++model_updates == MODEL_LOSS_WINDOW) {
+				model.learnLoss(model_output_sum, target);
+				model.save(start_eeprom_write(eeprom_base+MODEL_OFFSET,
+						HeaterModel::SAVED_SIZE));
+				model_phase = MODEL_HOLDING;
+			}
+		}
+	}
+	return mv;
 }
 
 void Heater::set_output(uint8_t value)
 {
+	output = value;
 	element.setHeatingElement(value);
 }
 
 void Heater::fail()
 {
+	if (autotune.heater == this && autotune.state == AUTOTUNE_RUNNING) {
+		autotune.state = AUTOTUNE_FAILED;
+	}
 	fail_state = true;
 	set_output(0);
 }
@@ -186,3 +359,147 @@ bool Heater::has_failed()
 {
 	return fail_state;
 }
+
+void Heater::start_autotune(int temp)
+{
+	if (autotune.heater != 0 && autotune.heater != this) {
+		autotune.heater->set_target_temperature(0);
+	}
+	autotune.heater = this;
+	autotune.state = fail_state ? AUTOTUNE_FAILED : AUTOTUNE_RUNNING;
+	autotune.heating = true;
+	autotune.setpoint = temp;
+	autotune.updates = 0;
+	autotune.switches = 0;
+	autotune.period_sum = 0;
+	autotune.swing_sum = 0;
+	// Show the target to the host while tuning
+	pid.setTarget(temp);
+}
+
+/// Run one PID update's worth of the autotune: switch the heater fully on
+/// below the target and off above it, and measure the period and swing of
+/// the resulting oscillation.
+void Heater::autotune_step()
+{
+	const int temp = current_temperature;
+	if (++autotune.updates > AUTOTUNE_MAX_UPDATES ||
+			temp > autotune.setpoint + AUTOTUNE_MAX_OVERSHOOT) {
+		autotune.state = AUTOTUNE_FAILED;
+		pid.setTarget(0);
+		set_output(0);
+		return;
+	}
+	if (temp > autotune.high) { autotune.high = temp; }
+	if (temp < autotune.low) { autotune.low = temp; }
+	if (autotune.heating) {
+		if (temp > autotune.setpoint + AUTOTUNE_HYSTERESIS) {
+			autotune.heating = false;
+		}
+	} else if (temp < autotune.setpoint - AUTOTUNE_HYSTERESIS) {
+		autotune.heating = true;
+		autotune.switches++;
+		// The first switch-on starts the settling cycle, the second the
+		// first measured one.
+		if (autotune.switches > 2) {
+			autotune.period_sum += autotune.updates - autotune.cycle_start;
+			autotune.swing_sum += autotune.high - autotune.low;
+			if (autotune.switches == AUTOTUNE_CYCLES + 2) {
+				finish_autotune();
+				return;
+			}
+		}
+		autotune.cycle_start = autotune.updates;
+		autotune.high = autotune.low = temp;
+	}
+	set_output(autotune.heating ? 255 : 0);
+}
+
+/// Clamp a gain to what fits in 8.8 fixed point.
+inline uint16_t clampGain(uint32_t gain) {
+	return gain > 0xffff ? 0xffff : (uint16_t)gain;
+}
+
+/// Work out the gains from the measured oscillation with the Ziegler-Nichols
+/// rules, save and apply them.
+void Heater::finish_autotune()
+{
+	// A relay swinging the output by +/-d (127.5 counts) about its mean
+	// makes an oscillation of amplitude a (half the swing) with ultimate
+	// gain Ku = 4d/(pi*a) counts/degree and period Tu.  The classic rules
+	// give Kp = 0.6Ku, Ki = 2Kp/Tu and Kd = Kp*Tu/8.  The PID runs every
+	// half second, scales its output by 2, sums the error once per update
+	// and takes the error change over 4 updates (2 s), so in its units
+	// P = Kp/2, I = Kp/(2Tu) = 2P/updates and D = Kp*Tu/32 = P*updates/32,
+	// where updates is Tu in PID updates.  In 8.8 fixed point,
+	// P = 0.6 * 4 * 127.5 * 2 / (pi * swing) / 2 * 256 = 24934 / swing.
+	const uint32_t p = 24934UL * AUTOTUNE_CYCLES / autotune.swing_sum;
+	autotune.p = clampGain(p);
+	autotune.i = clampGain(2 * p * AUTOTUNE_CYCLES / autotune.period_sum);
+	autotune.d = clampGain(p * autotune.period_sum / (32UL * AUTOTUNE_CYCLES));
+
+	// The gains follow each other in EEPROM, in the layout read by
+	// getEepromFixed16().
+	const uint16_t gains[3] = { autotune.p, autotune.i, autotune.d };
+	uint8_t* data = start_eeprom_write(eeprom_base, sizeof(gains));
+	for (uint8_t n = 0; n < 3; n++) {
+		data[2*n] = gains[n] >> 8;
+		data[2*n+1] = gains[n] & 0xff;
+	}
+	pid.setPGain(autotune.p);
+	pid.setIGain(autotune.i);
+	pid.setDGain(autotune.d);
+
+	autotune.state = AUTOTUNE_DONE;
+	pid.setTarget(0);
+	set_output(0);
+}
+
+/// Start writing length bytes to the given EEPROM location, finishing any
+/// earlier write first.  Returns the buffer for the caller to fill before
+/// the next call to manage_temperature().
+uint8_t* Heater::start_eeprom_write(uint16_t address, uint8_t length)
+{
+	flush_eeprom();
+	eeprom_address = address;
+	eeprom_length = length;
+	eeprom_index = 0;
+	return eeprom_data;
+}
+
+/// Write the next byte of the pending EEPROM write, if the EEPROM is free.
+/// Bytes that already hold the right value are skipped.
+void Heater::write_eeprom_byte()
+{
+	if (eeprom_length == 0 || !eeprom_is_ready()) {
+		return;
+	}
+	uint8_t* address = (uint8_t*)(eeprom_address + eeprom_index);
+	const uint8_t value = eeprom_data[eeprom_index];
+	if (eeprom_read_byte(address) != value) {
+		eeprom_write_byte(address, value);
+	}
+	if (++eeprom_index == eeprom_length) {
+		eeprom_length = 0;
+	}
+}
+
+/// Finish the pending EEPROM write, blocking until it is done.
+void Heater::flush_eeprom()
+{
+	while (eeprom_length != 0) {
+		write_eeprom_byte();
+	}
+}
+
+Heater::AutotuneState Heater::getAutotuneState()
+{
+	return (AutotuneState)autotune.state;
+}
+
+void Heater::getAutotuneGains(uint16_t& p, uint16_t& i, uint16_t& d)
+{
+	p = autotune.p;
+	i = autotune.i;
+	d = autotune.d;
+}
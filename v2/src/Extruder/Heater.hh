@@ -22,6 +22,7 @@
 #include "HeatingElement.hh"
 #include "AvrPort.hh"
 #include "PID.hh"
+#include "HeaterModel.hh"
 #include "Types.hh"
 #include "Timeout.hh"
 
@@ -41,14 +42,61 @@ class Heater
     bool bypassing_PID;
 
     bool fail_state;
+    uint8_t output;
+
+    // Heat-ups guided by the thermal model, when enabled by EF_HEATER_MODEL
+    enum ModelPhase {
+    	MODEL_HOLDING,		// PID plus feed-forward
+    	MODEL_HEATING,		// Full power, until the predicted coast reaches the target
+    	MODEL_COASTING,		// Feed-forward only, until the temperature peaks
+    	MODEL_SETTLING		// As holding, measuring the holding power
+    };
+    HeaterModel model;
+    bool using_model;
+    uint8_t model_phase;
+    uint8_t model_updates;
+    uint8_t model_peak_at;
+    // Temperature at the start of the rate window, or the peak when coasting
+    int model_temp;
+    // Rate windows of this heat-up, and the rise and middle temperature of
+    // the first counted and the latest
+    uint8_t model_windows;
+    uint8_t model_first_rise;
+    uint8_t model_last_rise;
+    int model_first_temp;
+    int model_last_temp;
+    uint16_t model_output_sum;
+
+    // Gains or model waiting to be written to EEPROM.  Writing a byte takes
+    // over 3ms, so they go out a byte per call to manage_temperature() to
+    // keep the board answering the motherboard.
+    uint8_t eeprom_data[6];
+    uint16_t eeprom_address;
+    uint8_t eeprom_length;
+    uint8_t eeprom_index;
 
     // This is the interval between PID calculations.  Longer updates are (counterintuitively)
     // better since we're using discrete D.
     const static micros_t UPDATE_INTERVAL_MICROS = 500L * 1000L;
 
     void fail();
+    uint8_t model_output();
+    void autotune_step();
+    void finish_autotune();
+    uint8_t* start_eeprom_write(uint16_t address, uint8_t length);
+    void write_eeprom_byte();
+    void flush_eeprom();
 
   public:
+    /// Progress of the relay autotune (see start_autotune()).  Only one
+    /// heater is tuned at a time, so the state is shared.
+    enum AutotuneState {
+    	AUTOTUNE_IDLE = 0,
+    	AUTOTUNE_RUNNING = 1,
+    	AUTOTUNE_DONE = 2,
+    	AUTOTUNE_FAILED = 3
+    };
+
     Heater(TemperatureSensor& sensor, HeatingElement& element, const micros_t sample_interval_micros, const uint16_t eeprom_base);
     
     int get_current_temperature();
@@ -57,14 +105,25 @@ class Heater
     bool has_reached_target_temperature();
     bool has_failed();
 
-    // Call once each temperature interval
-    void manage_temperature();
+    // Call once each temperature interval.  Returns true if the output was
+    // updated.
+    bool manage_temperature();
 
     void set_output(uint8_t value);
+    uint8_t get_output() { return output; }
 
     // Reset to board-on state
     void reset();
 
+    // Find PID gains by driving the heater as a relay around the given
+    // temperature and measuring the oscillation.  The gains are saved to
+    // EEPROM and used from then on, and the heater is turned off.  Setting
+    // a target temperature or resetting cancels the tune.
+    void start_autotune(int temp);
+    static AutotuneState getAutotuneState();
+    // The gains found by the last successful tune, in 8.8 fixed point
+    static void getAutotuneGains(uint16_t& p, uint16_t& i, uint16_t& d);
+
     int getPIDErrorTerm();
     int getPIDDeltaTerm();
     int getPIDLastOutput();
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2010 by Adam Mayer	 <adam@makerbot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "HeaterModel.hh"
+#include "EepromMap.hh"
+
+// Each measurement moves a learned parameter 1/MODEL_BLEND of the way to
+// the measured value.
+#define MODEL_BLEND 4
+
+// Holding power is too small to measure this close to ambient.
+#define MODEL_MIN_LOSS_DELTA 20
+
+void HeaterModel::load(uint16_t location) {
+	rate = eeprom::getEeprom16(location, UNKNOWN);
+	loss = eeprom::getEeprom16(location + 2, UNKNOWN);
+	dead_time = eeprom::getEeprom8(location + 4, UNKNOWN_DEAD_TIME);
+}
+
+void HeaterModel::save(uint8_t* data) {
+	data[0] = rate & 0xff;
+	data[1] = rate >> 8;
+	data[2] = loss & 0xff;
+	data[3] = loss >> 8;
+	data[4] = dead_time;
+}
+
+/// Move a learned value towards a measured one.
+uint16_t blend(uint16_t learned, uint32_t measured) {
+	if (measured >= HeaterModel::UNKNOWN) {
+		measured = HeaterModel::UNKNOWN - 1;
+	}
+	if (learned == HeaterModel::UNKNOWN) {
+		return measured;
+	}
+	return learned + ((int32_t)measured - learned) / MODEL_BLEND;
+}
+
+/// Output going into losses at the given temperature
+uint8_t lossOutput(uint16_t loss, int temp) {
+	if (loss == HeaterModel::UNKNOWN || temp <= MODEL_AMBIENT) {
+		return 0;
+	}
+	const uint32_t output = ((uint32_t)loss * (temp - MODEL_AMBIENT)) >> 8;
+	return output > 255 ? 255 : output;
+}
+
+uint8_t HeaterModel::feedForward(int temp) {
+	return lossOutput(loss, temp);
+}
+
+int HeaterModel::coast(int temp) {
+	if (rate == UNKNOWN || dead_time == UNKNOWN_DEAD_TIME) {
+		return -1;
+	}
+	// Net heating rate at full power, in 8.8 degrees per update
+	const uint32_t net = (uint32_t)rate * (255 - lossOutput(loss, temp)) / 255;
+	return (net * dead_time + 128) >> 8;
+}
+
+void HeaterModel::learnRate(int rise, int temp) {
+	const uint8_t lost = lossOutput(loss, temp);
+	// Too little left over to tell the rate by
+	if (rise <= 0 || lost > 240) {
+		return;
+	}
+	rate = blend(rate, ((uint32_t)rise << 8) * 255 /
+			(MODEL_RATE_WINDOW * (uint16_t)(255 - lost)));
+}
+
+void HeaterModel::learnHeatup(uint8_t rise1, int temp1, uint8_t rise2, int temp2) {
+	if (temp2 - temp1 < MODEL_MIN_LOSS_DELTA || temp1 < MODEL_AMBIENT ||
+			rise2 >= rise1) {
+		return;
+	}
+	// The rate at full power falls off in a straight line, a - b*(T - Ta),
+	// where a is the rate and b = a*loss/(255*256).
+	const uint16_t b = rise1 - rise2;
+	const uint32_t a_span = (uint32_t)rise1 * (temp2 - temp1) +
+			(uint32_t)b * (temp1 - MODEL_AMBIENT);
+	loss = blend(loss, 255UL * 256 * b / a_span);
+}
+
+void HeaterModel::learnDeadTime(uint8_t updates) {
+	if (updates >= UNKNOWN_DEAD_TIME) {
+		updates = UNKNOWN_DEAD_TIME - 1;
+	}
+	if (dead_time == UNKNOWN_DEAD_TIME) {
+		dead_time = updates;
+	} else {
+		dead_time += ((int)updates - dead_time) / MODEL_BLEND;
+	}
+}
+
+void HeaterModel::learnLoss(uint16_t output_sum, int temp) {
+	if (temp < MODEL_AMBIENT + MODEL_MIN_LOSS_DELTA) {
+		return;
+	}
+	loss = blend(loss, ((uint32_t)output_sum << 8) /
+			(MODEL_LOSS_WINDOW * (uint32_t)(temp - MODEL_AMBIENT)));
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2010 by Adam Mayer	 <adam@makerbot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef HEATER_MODEL_HH_
+#define HEATER_MODEL_HH_
+
+#include <stdint.h>
+
+/// Temperature the heaters lose heat to, in degrees Celsius
+#define MODEL_AMBIENT 25
+
+/// Number of PID updates at full power over which the heating rate is
+/// measured
+#define MODEL_RATE_WINDOW 16
+/// Number of PID updates at the target over which the holding power is
+/// measured
+#define MODEL_LOSS_WINDOW 64
+
+/**
+ * First-order thermal model of a heater, learned from its heat-ups and
+ * kept in EEPROM.  Times are counted in PID updates.  The model has three
+ * parameters:
+ *
+ * - the heating rate at full power, were there no losses, in degrees per
+ *   update (which stands for the heat capacity);
+ * - the loss, as the output needed to hold each degree above ambient;
+ * - the dead time, from cutting the power to the temperature peaking.
+ *
+ * Rates and losses are in 8.8 fixed point, like the PID gains.
+ */
+class HeaterModel {
+public:
+	/// Values of an unlearned parameter
+	const static uint16_t UNKNOWN = 0xffff;
+	const static uint8_t UNKNOWN_DEAD_TIME = 0xff;
+
+	uint16_t rate;
+	uint16_t loss;
+	uint8_t dead_time;
+
+	/// Bytes the model takes in EEPROM
+	const static uint8_t SAVED_SIZE = 5;
+
+	/// Read the model from the given EEPROM location.
+	void load(uint16_t location);
+	/// Lay the model out as load() reads it, in SAVED_SIZE bytes.
+	void save(uint8_t* data);
+
+	/// Output that holds the heater at the given temperature
+	uint8_t feedForward(int temp);
+	/// Degrees the temperature will rise after cutting full power at the
+	/// given temperature, or -1 if that isn't known yet.
+	int coast(int temp);
+
+	/// Learn from a rise of the given number of degrees over
+	/// MODEL_RATE_WINDOW updates at full power, centred on temp.
+	void learnRate(int rise, int temp);
+	/// Learn the loss from the heating rate falling off over a heat-up, from
+	/// rises of rise1 and rise2 degrees over MODEL_RATE_WINDOW updates at
+	/// full power, centred on temp1 and temp2.
+	void learnHeatup(uint8_t rise1, int temp1, uint8_t rise2, int temp2);
+	/// Learn from the temperature peaking the given number of updates after
+	/// full power was cut.
+	void learnDeadTime(uint8_t updates);
+	/// Learn the loss from the output summed over MODEL_LOSS_WINDOW updates
+	/// holding the given temperature.
+	void learnLoss(uint16_t output_sum, int temp);
+};
+
+#endif // HEATER_MODEL_HH_
@@ -28,12 +28,33 @@
 #include "MotorController.hh"
 #include "Main.hh"
 #include "EepromMap.hh"
+#include "Telemetry.hh"
 
 // Timeout from time first bit recieved until we abort packet reception
 Timeout packet_in_timeout;
 
 #define HOST_PACKET_TIMEOUT_MS 20L
 #define HOST_PACKET_TIMEOUT_MICROS (1000L*HOST_PACKET_TIMEOUT_MS)
+
+// The rate we start at, and fall back to when a faster rate doesn't work out.
+#define DEFAULT_BAUD_RATE BaudRate::BAUD_38400
+// After switching rates we must hear a valid packet at the new rate within
+// this window, or we go back to the default rate.
+#define BAUD_RATE_CONFIRM_MS 1000L
+#define BAUD_RATE_CONFIRM_MICROS (1000L*BAUD_RATE_CONFIRM_MS)
+// Consecutive receive errors at a confirmed non-default rate after which we
+// assume the motherboard has gone back to the default rate.
+#define BAUD_RATE_MAX_ERRORS 4
+
+// Rate change requested by the last packet, applied once the response is
+// on its way.
+#define NO_BAUD_RATE_CHANGE 0xff
+uint8_t new_baud_rate = NO_BAUD_RATE_CHANGE;
+// Set while a rate change awaits its first valid packet.
+bool baud_rate_unconfirmed = false;
+Timeout baud_rate_confirm_timeout;
+uint8_t baud_rate_errors = 0;
+
 inline void handleReadEeprom(const InPacket& from_host, OutPacket& to_host) {
 	const uint16_t offset = from_host.read16(2);
 	const uint8_t count = from_host.read8(4);
@@ -71,6 +92,50 @@ inline void handlePause(const InPacket& from_host, OutPacket& to_host) {
 	to_host.append8(RC_OK);
 }
 
+inline void handleSetBaudRate(const InPacket& from_host, OutPacket& to_host) {
+	const uint8_t rate = from_host.read8(2);
+	if (rate >= BaudRate::COUNT) {
+		to_host.append8(RC_CMD_UNSUPPORTED);
+	} else {
+		new_baud_rate = rate;
+		to_host.append8(RC_OK);
+	}
+}
+
+inline void handleAutotunePID(const InPacket& from_host, OutPacket& to_host) {
+	ExtruderBoard& board = ExtruderBoard::getBoard();
+	const uint8_t heater = from_host.read8(2);
+	const int temp = from_host.read16(3);
+	if (heater == 0) {
+		board.getExtruderHeater().start_autotune(temp);
+	} else if (heater == 1) {
+		board.setUsingPlatform(true);
+		board.getPlatformHeater().start_autotune(temp);
+	} else {
+		to_host.append8(RC_CMD_UNSUPPORTED);
+		return;
+	}
+	to_host.append8(RC_OK);
+}
+
+inline void handleGetAutotuneStatus(const InPacket& from_host, OutPacket& to_host) {
+	uint16_t p, i, d;
+	Heater::getAutotuneGains(p, i, d);
+	to_host.append8(RC_OK);
+	to_host.append8(Heater::getAutotuneState());
+	to_host.append16(p);
+	to_host.append16(i);
+	to_host.append16(d);
+}
+
+/// Drop back to the default rate, where the motherboard will look for us
+/// after a failed transaction or a reset.
+void fallBackToDefaultRate() {
+	ExtruderBoard::getBoard().getHostUART().setRate(DEFAULT_BAUD_RATE);
+	baud_rate_unconfirmed = false;
+	baud_rate_errors = 0;
+}
+
 bool do_host_reset = false;
 
 bool processQueryPacket(const InPacket& from_host, OutPacket& to_host) {
@@ -179,6 +244,18 @@ bool processQueryPacket(const InPacket& from_host, OutPacket& to_host) {
 			to_host.append8(RC_OK);
 			to_host.append8(board.getPlatformHeater().has_reached_target_temperature()?1:0);
 			return true;
+		case SLAVE_CMD_SET_BAUD_RATE:
+			handleSetBaudRate(from_host, to_host);
+			return true;
+		case SLAVE_CMD_AUTOTUNE_PID:
+			handleAutotunePID(from_host, to_host);
+			return true;
+		case SLAVE_CMD_GET_AUTOTUNE_STATUS:
+			handleGetAutotuneStatus(from_host, to_host);
+			return true;
+		case SLAVE_CMD_GET_TELEMETRY:
+			telemetry::appendSamples(from_host.read16(2), to_host);
+			return true;
 		case SLAVE_CMD_GET_TOOL_STATUS:
 			to_host.append8(RC_OK);
 			to_host.append8( (board.getExtruderHeater().has_failed()?128:0)
@@ -205,8 +282,13 @@ void runHostSlice() {
 	}
 	if (do_host_reset) {
 		do_host_reset = false;
+		// The motherboard renegotiates the rate after every reset.
+		fallBackToDefaultRate();
 		reset();
 	}
+	if (baud_rate_unconfirmed && baud_rate_confirm_timeout.hasElapsed()) {
+		fallBackToDefaultRate();
+	}
 	if (in.isStarted() && !in.isFinished()) {
 		if (!packet_in_timeout.isActive()) {
 			// initiate timeout
@@ -218,6 +300,10 @@ void runHostSlice() {
 	}
 	if (in.hasError()) {
 		packet_in_timeout.abort();
+		if (!baud_rate_unconfirmed && uart.getRate() != DEFAULT_BAUD_RATE &&
+				++baud_rate_errors >= BAUD_RATE_MAX_ERRORS) {
+			fallBackToDefaultRate();
+		}
 		// REPORTING: report error.
 		// Reset packet quickly and start handling the next packet.
 		in.reset();
@@ -228,6 +314,9 @@ void runHostSlice() {
 		const uint8_t slave_id = eeprom::getEeprom8(eeprom::SLAVE_ID, 0);
 		const uint8_t target = in.read8(0);
 		packet_in_timeout.abort();
+		// Any valid packet shows that the current rate works.
+		baud_rate_unconfirmed = false;
+		baud_rate_errors = 0;
 		// SPECIAL CASE: we always process debug packets!
 		if (processDebugPacket(in,out)) {
 			// okay, processed
@@ -246,5 +335,12 @@ void runHostSlice() {
 		}
 		in.reset();
 		uart.beginSend();
+		if (new_baud_rate != NO_BAUD_RATE_CHANGE) {
+			// Takes effect once the response has been sent.
+			uart.setRate(new_baud_rate);
+			baud_rate_unconfirmed = (new_baud_rate != DEFAULT_BAUD_RATE);
+			baud_rate_confirm_timeout.start(BAUD_RATE_CONFIRM_MICROS);
+			new_baud_rate = NO_BAUD_RATE_CHANGE;
+		}
 	}
 }
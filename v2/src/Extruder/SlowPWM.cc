@@ -0,0 +1,56 @@
+/*
+ * Copyright 2010 by Adam Mayer	 <adam@makerbot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "SlowPWM.hh"
+
+SlowPWM::SlowPWM() : window_micros(0), value(0), on(false) {}
+
+void SlowPWM::setWindow(micros_t window_micros_in) {
+	window_micros = window_micros_in;
+	window_timeout.abort();
+}
+
+void SlowPWM::setValue(uint8_t value_in) {
+	value = value_in;
+	if (value == 0) {
+		on = false;
+	}
+}
+
+bool SlowPWM::run() {
+	if (window_micros == 0) {
+		on = value != 0;
+		return on;
+	}
+	if (window_timeout.hasElapsed() || !window_timeout.isActive()) {
+		window_timeout.start(window_micros);
+		const micros_t pulse = (window_micros / 255) * value;
+		const micros_t min_pulse = window_micros / 16;
+		if (pulse < min_pulse) {
+			on = false;
+		} else {
+			on = true;
+			// Running past the end of the window keeps the output on into
+			// the next one.
+			pulse_timeout.start(window_micros - pulse < min_pulse ?
+					window_micros + min_pulse : pulse);
+		}
+	} else if (on && pulse_timeout.hasElapsed()) {
+		on = false;
+	}
+	return on;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2010 by Adam Mayer	 <adam@makerbot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef SLOW_PWM_HH_
+#define SLOW_PWM_HH_
+
+#include <stdint.h>
+#include "Types.hh"
+#include "Timeout.hh"
+
+/// Time-proportioned output for loads that can't be switched quickly, such
+/// as relays and large heaters.  The output is turned on for a share of
+/// each window of a few seconds, in proportion to the value set.  Pulses
+/// shorter than a sixteenth of the window are rounded off, so the load
+/// never switches more than twice per window or for less than that time.
+class SlowPWM {
+private:
+	Timeout window_timeout;
+	Timeout pulse_timeout;
+	micros_t window_micros;
+	uint8_t value;
+	bool on;
+public:
+	SlowPWM();
+	/// Set the window length.  A window of zero turns the output on
+	/// whenever the value is non-zero.
+	void setWindow(micros_t window_micros);
+	/// Set the value, from 0 (off) to 255 (on), used from the next window.
+	/// Zero turns the output off straight away.
+	void setValue(uint8_t value);
+	/// Update the output state; call this often.  Returns true if the
+	/// output should be on.
+	bool run();
+	bool isOn() const { return on; }
+};
+
+#endif // SLOW_PWM_HH_
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2010 by Adam Mayer	 <adam@makerbot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "Telemetry.hh"
+#include "ExtruderBoard.hh"
+
+// Reply header: response code, first sample number and sample count
+#define TELEMETRY_HEADER_SIZE 4
+
+namespace telemetry {
+
+uint8_t samples[TELEMETRY_SAMPLES][TELEMETRY_SAMPLE_SIZE];
+/// Number of the next sample to be recorded
+uint16_t next_sample = 0;
+/// Number of samples in the ring
+uint8_t stored = 0;
+
+/// Clamp a value to the range of an unsigned field of the given width.
+inline uint32_t field(int value, uint8_t bits) {
+	const int max = (1 << bits) - 1;
+	if (value < 0) { return 0; }
+	if (value > max) { return max; }
+	return value;
+}
+
+void record(uint8_t index, Heater& heater) {
+	uint8_t* sample = samples[next_sample % TELEMETRY_SAMPLES];
+	uint32_t word = field(heater.get_current_temperature(), 10) |
+			(field(heater.get_set_temperature(), 10) << 10) |
+			(field(heater.getPIDErrorTerm() + 512, 10) << 20);
+	if (index != 0) { word |= 1UL << 30; }
+	if (heater.has_failed()) { word |= 1UL << 31; }
+	for (uint8_t i = 0; i < 4; i++) {
+		sample[i] = word & 0xff;
+		word >>= 8;
+	}
+	sample[4] = heater.get_output();
+	int delta = heater.getPIDDeltaTerm();
+	if (delta > 127) { delta = 127; }
+	if (delta < -128) { delta = -128; }
+	sample[5] = (int8_t)delta;
+	sample[6] = ExtruderBoard::getBoard().getCurrentMicros() >> 16;
+	next_sample++;
+	if (stored < TELEMETRY_SAMPLES) {
+		stored++;
+	}
+}
+
+void appendSamples(uint16_t since, OutPacket& to_host) {
+	// Samples after since, counting wrap-around.  Numbers ahead of the
+	// ring, from before a reset, start from the oldest sample.
+	uint16_t available = next_sample - since;
+	if (available > stored) {
+		available = stored;
+		since = next_sample - available;
+	}
+	uint8_t count = (MAX_PACKET_PAYLOAD - TELEMETRY_HEADER_SIZE) / TELEMETRY_SAMPLE_SIZE;
+	if (available < count) {
+		count = available;
+	}
+	to_host.append8(RC_OK);
+	to_host.append16(since);
+	to_host.append8(count);
+	for (uint8_t i = 0; i < count; i++) {
+		const uint8_t* sample = samples[(uint16_t)(since + i) % TELEMETRY_SAMPLES];
+		for (uint8_t j = 0; j < TELEMETRY_SAMPLE_SIZE; j++) {
+			to_host.append8(sample[j]);
+		}
+	}
+}
+
+} // namespace telemetry
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2010 by Adam Mayer	 <adam@makerbot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef TELEMETRY_HH_
+#define TELEMETRY_HH_
+
+#include <stdint.h>
+#include "Heater.hh"
+#include "Packet.hh"
+
+/// Number of samples kept, a power of two; each takes TELEMETRY_SAMPLE_SIZE
+/// bytes of RAM.
+#ifndef TELEMETRY_SAMPLES
+#define TELEMETRY_SAMPLES 16
+#endif
+
+/**
+ * Each sample is packed into TELEMETRY_SAMPLE_SIZE bytes:
+ *
+ *   uint32_t  bits 0-9   temperature, in degrees Celsius
+ *             bits 10-19 set point, in degrees Celsius
+ *             bits 20-29 PID error accumulator, plus 512
+ *             bit 30     heater: 0 extruder, 1 platform
+ *             bit 31     set if the heater has failed
+ *   uint8_t   heater output
+ *   int8_t    PID delta term
+ *   uint8_t   time, in units of 65.536ms, wrapping every 16.8s
+ *
+ * Values are clamped to fit.
+ */
+#define TELEMETRY_SAMPLE_SIZE 7
+
+/// A ring of samples of the heaters' state, recorded each time they
+/// update, for the host to download in bulk.  Samples are numbered from
+/// zero; the number wraps at 65536.
+namespace telemetry {
+
+/// Record a sample of the given heater (0: extruder, 1: platform).
+void record(uint8_t index, Heater& heater);
+
+/// Append to the packet the number of the first sample that follows, the
+/// number of samples, and as many samples as fit, starting with the given
+/// one or the oldest still kept if it has been overwritten.
+void appendSamples(uint16_t since, OutPacket& to_host);
+
+} // namespace telemetry
+
+#endif // TELEMETRY_HH_
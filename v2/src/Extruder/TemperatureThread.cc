@@ -17,11 +17,17 @@
 
 #include "ExtruderBoard.hh"
 #include "TemperatureThread.hh"
+#include "Telemetry.hh"
 
 void runTempSlice() {
 	ExtruderBoard& board = ExtruderBoard::getBoard();
-	board.getExtruderHeater().manage_temperature();
+	if (board.getExtruderHeater().manage_temperature()) {
+		telemetry::record(0, board.getExtruderHeater());
+	}
 	if (board.isUsingPlatform()) {
-		board.getPlatformHeater().manage_temperature();
+		if (board.getPlatformHeater().manage_temperature()) {
+			telemetry::record(1, board.getPlatformHeater());
+		}
+		board.runPlatformSlice();
 	}
 }
@@ -17,6 +17,7 @@
 
 #include "ThermistorTable.hh"
 #include "EepromMap.hh"
+#include "AnalogPin.hh"
 #include <avr/eeprom.h>
 #include <stdint.h>
 #include <avr/pgmspace.h>
@@ -87,7 +88,9 @@ inline Entry getEntry(int8_t entryIdx, int8_t which) {
 	return rv;
 }
 
-int16_t thermistorToCelsius(int16_t reading, int8_t table_idx) {
+/// Convert a reading with the full table.  Readings off either end of the
+/// table are extrapolated from the end segments.
+int16_t interpolateTable(int16_t reading, int8_t table_idx) {
   int8_t bottom = 0;
   int8_t top = NUMTEMPS-1;
   int8_t mid = (bottom+top)/2;
@@ -106,20 +109,48 @@ int16_t thermistorToCelsius(int16_t reading, int8_t table_idx) {
   }
   Entry eb = getEntry(bottom,table_idx);
   Entry et = getEntry(top,table_idx);
-  if (bottom == 0 && reading < eb.adc) {
-	  // out of scale; safety mode
-	  return 255;
-  }
-  if (top == NUMTEMPS-1 && reading > et.adc) {
+  return eb.value +
+		  ((int32_t)(reading - eb.adc) * (et.value - eb.value)) / (et.adc - eb.adc);
+}
+
+/// The tables are decoded at startup into temperatures at every
+/// DENSE_STEP ADC counts, clamped to 0-255, so that a conversion is one
+/// lookup and a short interpolation rather than a search through the
+/// table in EEPROM or flash.  Resampling the table at this spacing is
+/// within a degree of interpolating it directly, for 130 bytes of RAM.
+#define DENSE_SHIFT 4
+#define DENSE_STEP (1 << DENSE_SHIFT)
+#define DENSE_ENTRIES ((1024 >> DENSE_SHIFT) + 1)
+/// Shift from a reading to its dense table entry
+#define READING_SHIFT (DENSE_SHIFT + ANALOG_FRACTION_BITS)
+
+uint8_t dense_table[2][DENSE_ENTRIES];
+/// Range of readings each table covers; readings outside it are out of
+/// scale.
+int16_t min_adc[2];
+int16_t max_adc[2];
+
+int16_t thermistorToCelsius(int16_t reading, int8_t table_idx) {
+  if (reading < (min_adc[table_idx] << ANALOG_FRACTION_BITS) ||
+		  reading > (max_adc[table_idx] << ANALOG_FRACTION_BITS)) {
 	  // out of scale; safety mode
 	  return 255;
   }
+  const uint8_t* entry = dense_table[table_idx] + (reading >> READING_SHIFT);
+  const int16_t base = entry[0];
+  return base + (((int16_t)entry[1] - base) *
+		  (reading & ((1 << READING_SHIFT)-1)) >> READING_SHIFT);
+}
 
-  int16_t celsius  = eb.value +
-		  ((reading - eb.adc) * (et.value - eb.value)) / (et.adc - eb.adc);
-  if (celsius > 255)
-	  celsius = 255;
-  return celsius;
+void decodeTable(int8_t which) {
+	min_adc[which] = getEntry(0,which).adc;
+	max_adc[which] = getEntry(NUMTEMPS-1,which).adc;
+	for (uint8_t i = 0; i < DENSE_ENTRIES; i++) {
+		int16_t celsius = interpolateTable(i * DENSE_STEP, which);
+		if (celsius > 255) { celsius = 255; }
+		if (celsius < 0) { celsius = 0; }
+		dense_table[which][i] = celsius;
+	}
 }
 
 bool isTableSet(uint16_t off) {
@@ -133,4 +164,6 @@ bool isTableSet(uint16_t off) {
 void initThermistorTables() {
 	has_table[0] = isTableSet(eeprom::THERM_TABLE_0 + eeprom::THERM_DATA_OFFSET);
 	has_table[1] = isTableSet(eeprom::THERM_TABLE_1 + eeprom::THERM_DATA_OFFSET);
+	decodeTable(0);
+	decodeTable(1);
 }
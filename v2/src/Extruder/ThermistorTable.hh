@@ -20,6 +20,8 @@
 
 #include <stdint.h>
 
+/// Convert a reading from getAnalogReading(), with ANALOG_FRACTION_BITS
+/// below the ADC's resolution, to degrees Celsius.
 int16_t thermistorToCelsius(int16_t reading, int8_t table_idx);
 
 // initThermTable should be called on boot.
@@ -85,4 +85,8 @@
 
 #define SAMPLE_INTERVAL_MICROS_THERMISTOR (50L * 1000L)
 
+// Default length of the time-proportioned output window for the platform
+// heater, overridden by eeprom::HBP_PWM_WINDOW.
+#define PLATFORM_PWM_WINDOW_MS 2000
+
 #endif // BOARDS_ECV22_CONFIGURATION_HH_
@@ -115,6 +115,8 @@ void ExtruderBoard::reset() {
 	platform_thermistor.init();
 	extruder_heater.reset();
 	platform_heater.reset();
+	platform_element.setWindow(100000L *
+			eeprom::getEeprom8(eeprom::HBP_PWM_WINDOW, PLATFORM_PWM_WINDOW_MS / 100));
 	getHostUART().enable(true);
 	getHostUART().in.reset();
 
@@ -275,10 +277,12 @@ void ExtruderHeatingElement::setHeatingElement(uint8_t value) {
 }
 
 void BuildPlatformHeatingElement::setHeatingElement(uint8_t value) {
-	// This is a bit of a hack to get the temperatures right until we fix our
-	// PWM'd PID implementation.  We reduce the MV to one bit, essentially.
-	// It works relatively well.
-	setChannel(hbp_channel,value,true);
+	pwm.setValue(value);
+	runSlice();
+}
+
+void BuildPlatformHeatingElement::runSlice() {
+	setChannel(hbp_channel,pwm.run()?255:0,true);
 }
 
 ISR(TIMER2_OVF_vect) {
@@ -23,6 +23,7 @@
 #include "Thermistor.hh"
 #include "HeatingElement.hh"
 #include "Heater.hh"
+#include "SlowPWM.hh"
 
 // Definition of the extruder heating element
 class ExtruderHeatingElement : public HeatingElement {
@@ -30,10 +31,15 @@ public:
 	void setHeatingElement(uint8_t value);
 };
 
-// Definition of the heated build platform heating element
+// Definition of the heated build platform heating element.  The platform
+// is driven with time-proportioned PWM, which is run from runSlice().
 class BuildPlatformHeatingElement : public HeatingElement {
+private:
+	SlowPWM pwm;
 public:
 	void setHeatingElement(uint8_t value);
+	void setWindow(micros_t window_micros) { pwm.setWindow(window_micros); }
+	void runSlice();
 };
 
 class ExtruderBoard {
@@ -63,6 +69,9 @@ public:
 	void indicateError(int errorCode);
 	bool isUsingPlatform() { return using_platform; }
 	void setUsingPlatform(bool is_using);
+	/// Switch the platform heater output; call this often while using the
+	/// platform.
+	void runPlatformSlice() { platform_element.runSlice(); }
 	void setUsingRelays(bool is_using);
 	// Index 0 = D9, Index 1 = D10.  Value = -1 to turn off, 0-255 to set position.
 	void setServo(uint8_t index, int value);
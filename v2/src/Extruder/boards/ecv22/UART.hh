@@ -19,6 +19,7 @@
 #define BOARDS_ECV22_UART_HH_
 
 #include "Packet.hh"
+#include "BaudRate.hh"
 #include <stdint.h>
 
 /**
@@ -27,11 +28,13 @@
  * call is made.  beginSend() calls will send completed
  * packets.
  *
- * All MB UARTs are presumed to run at 38400bps.
+ * The UART starts at 38400bps; the motherboard may negotiate a faster
+ * rate with setRate().
  */
 class UART {
 private:
 	volatile bool enabled;
+	uint8_t rate;
 	UART();
 	static UART uart;
 public:
@@ -39,6 +42,12 @@ public:
 	OutPacket out;
 	void beginSend();
 	void enable(bool enabled);
+	/// Switch to the given bit rate (see BaudRate.hh).  If a packet is
+	/// being transmitted, the switch is deferred until its last byte has
+	/// left the shift register.
+	void setRate(uint8_t rate);
+	/// Get the current bit rate code.
+	uint8_t getRate() const { return rate; }
 	static UART& getHostUART() { return uart; }
 	// Reset the UART to a listening state.  This is important for
 	// RS485-based comms.
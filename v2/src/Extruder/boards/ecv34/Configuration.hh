@@ -49,6 +49,9 @@
 #define THERMOCOUPLE_CS 	Pin(PortD,4)
 #define THERMOCOUPLE_SCK	Pin(PortB,5)
 #define THERMOCOUPLE_SO		Pin(PortB,4)
+// SCK and SO are the 168's SPI SCK and MISO pins, so the thermocouple is
+// read with the SPI rather than by toggling the pins.
+#define THERMOCOUPLE_HARDWARE_SPI 1
 
 // Heated platform configuration
 #define HAS_HEATED_PLATFORM		0
@@ -68,6 +71,12 @@
 // #define DEBUG_LED			Pin(PortB,5)
 
 #define SAMPLE_INTERVAL_MICROS_THERMISTOR (50L * 1000L)
-#define SAMPLE_INTERVAL_MICROS_THERMOCOUPLE (500L * 1000L)
+
+// Default length of the time-proportioned output window for the platform
+// heater, overridden by eeprom::HBP_PWM_WINDOW.
+#define PLATFORM_PWM_WINDOW_MS 2000
+// The MAX6675 takes up to 220ms to convert, and reading it before then
+// restarts the conversion.
+#define SAMPLE_INTERVAL_MICROS_THERMOCOUPLE (220L * 1000L)
 
 #endif // BOARDS_ECV34_CONFIGURATION_HH_
@@ -120,6 +120,8 @@ void ExtruderBoard::reset() {
 	platform_thermistor.init();
 	extruder_heater.reset();
 	platform_heater.reset();
+	platform_element.setWindow(100000L *
+			eeprom::getEeprom8(eeprom::HBP_PWM_WINDOW, PLATFORM_PWM_WINDOW_MS / 100));
 	setMotorSpeed(0);
 	getHostUART().enable(true);
 	getHostUART().in.reset();
@@ -181,11 +183,14 @@ void ExtruderHeatingElement::setHeatingElement(uint8_t value) {
 }
 
 void BuildPlatformHeatingElement::setHeatingElement(uint8_t value) {
-	// This is a bit of a hack to get the temperatures right until we fix our
-	// PWM'd PID implementation.  We reduce the MV to one bit, essentially.
-	// It works relatively well.
+	pwm.setValue(value);
+	runSlice();
+}
+
+void BuildPlatformHeatingElement::runSlice() {
+	const bool on = pwm.run();
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
 		pwmBOn(false);
-		CHANNEL_B.setValue(value != 0);
+		CHANNEL_B.setValue(on);
 	}
 }
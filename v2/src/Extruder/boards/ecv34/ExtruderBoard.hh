@@ -24,6 +24,7 @@
 #include "Thermocouple.hh"
 #include "HeatingElement.hh"
 #include "Heater.hh"
+#include "SlowPWM.hh"
 
 // Definition of the extruder heating element
 class ExtruderHeatingElement : public HeatingElement {
@@ -31,10 +32,15 @@ public:
 	void setHeatingElement(uint8_t value);
 };
 
-// Definition of the heated build platform heating element
+// Definition of the heated build platform heating element.  The platform
+// is driven with time-proportioned PWM, which is run from runSlice().
 class BuildPlatformHeatingElement : public HeatingElement {
+private:
+	SlowPWM pwm;
 public:
 	void setHeatingElement(uint8_t value);
+	void setWindow(micros_t window_micros) { pwm.setWindow(window_micros); }
+	void runSlice();
 };
 
 class ExtruderBoard {
@@ -61,6 +67,9 @@ public:
 	void indicateError(int errorCode);
 	bool isUsingPlatform() { return using_platform; }
 	void setUsingPlatform(bool is_using);
+	/// Switch the platform heater output; call this often while using the
+	/// platform.
+	void runPlatformSlice() { platform_element.runSlice(); }
 private:
 	Thermocouple extruder_thermocouple;
 	Thermistor platform_thermistor;
@@ -16,11 +16,8 @@
  */
 
 
-
 #include "Thermocouple.hh"
-#include <avr/eeprom.h>
-#include <util/atomic.h>
-#include <util/delay.h>
+#include <avr/io.h>
 #include "ExtruderBoard.hh"
 
 Thermocouple::Thermocouple(const Pin& cs,const Pin& sck,const Pin& so) :
@@ -29,46 +26,58 @@ Thermocouple::Thermocouple(const Pin& cs,const Pin& sck,const Pin& so) :
 }
 
 void Thermocouple::init() {
+	// Raising CS starts a conversion.
+	cs_pin.setValue(true);
 	cs_pin.setDirection(true);
+	sck_pin.setValue(false);
 	sck_pin.setDirection(true);
 	so_pin.setDirection(false);
+#ifdef THERMOCOUPLE_HARDWARE_SPI
+	// The SPI drops into slave mode if SS is an input and goes low.  On the
+	// 168, SS is PB2, which the board already uses as an output.
+	DDRB |= _BV(DDB2);
+	// Master, mode 0 (the MAX6675 changes SO on the falling edge), MSB
+	// first, clock/16: 1MHz, well under the MAX6675's 4.3MHz limit.
+	SPCR = _BV(SPE) | _BV(MSTR) | _BV(SPR0);
+#endif
 }
 
-// We'll throw in nops to get the timing right (if necessary)
-inline void nop() {
-	asm volatile("nop"::);
-	asm volatile("nop"::);
-	asm volatile("nop"::);
-	asm volatile("nop"::);
-	asm volatile("nop"::);
+#ifdef THERMOCOUPLE_HARDWARE_SPI
+inline uint8_t spiReadByte() {
+	SPDR = 0;
+	while ((SPSR & _BV(SPIF)) == 0) {}
+	return SPDR;
 }
+#endif
 
-Thermocouple::SensorState Thermocouple::update() {
+uint16_t Thermocouple::readWord() {
+	uint16_t word;
 	cs_pin.setValue(false);
-	nop();
-	sck_pin.setValue(false);
-	nop();
-	int raw = 0;
-	for (int i = 0; i < 16; i++) {
+#ifdef THERMOCOUPLE_HARDWARE_SPI
+	word = spiReadByte() << 8;
+	word |= spiReadByte();
+#else
+	// The port accesses take longer than the 100ns the MAX6675 needs
+	// between edges, so there's no need to pad them out.
+	word = 0;
+	for (uint8_t i = 0; i < 16; i++) {
 		sck_pin.setValue(true);
-		nop();
-		if (i >= 1 && i < 11) { // data bit... skip LSBs
-			raw = raw << 1;
-			if (so_pin.getValue()) { raw = raw | 0x01; }
-		}
-		if (i == 13) { // Safety check: Check for open thermocouple input
-			if (so_pin.getValue()) {
-				current_temp = 254;	// Set the temperature to 254 as an error condition
-				return SS_ERROR_UNPLUGGED;
-			}
-		}
+		word = (word << 1) | (so_pin.getValue() ? 1 : 0);
 		sck_pin.setValue(false);
-		nop();
 	}
+#endif
 	cs_pin.setValue(true);
-	nop();
-	sck_pin.setValue(false);
+	return word;
+}
 
-	current_temp = raw;
+Thermocouple::SensorState Thermocouple::update() {
+	// Bits 14-3 are the temperature in quarter degrees, and bit 2 is set
+	// if the thermocouple input is open.
+	const uint16_t word = readWord();
+	if ((word & 0x04) != 0) {
+		current_temp = 254;	// Set the temperature to 254 as an error condition
+		return SS_ERROR_UNPLUGGED;
+	}
+	current_temp = (word >> 5) & 0x3ff;
 	return SS_OK;
 }
@@ -27,6 +27,8 @@ private:
 	Pin cs_pin;
 	Pin sck_pin;
 	Pin so_pin;
+	/// Read the 16 bits of the last conversion, which starts the next.
+	uint16_t readWord();
 public:
 	Thermocouple(const Pin& cs,const Pin& sck,const Pin& so);
 	void init();
@@ -41,6 +41,23 @@ UART UART::uart;
 
 volatile uint8_t loopback_bytes = 0;
 
+// True from the start of a packet transmission until the last byte has
+// been shifted out.
+volatile bool transmitting = false;
+
+#define NO_PENDING_RATE 0xff
+// Rate change to apply once the current transmission completes.
+volatile uint8_t pending_rate = NO_PENDING_RATE;
+
+/// Runtime rate changes always use double speed mode, which gives the
+/// closest divisors at the higher rates.
+inline void applyRate(uint8_t rate) {
+	const uint16_t ubrr = baudRateToUbrr(rate);
+	UBRR0H = ubrr >> 8;
+	UBRR0L = ubrr & 0xff;
+	UCSR0A = _BV(U2X0);
+}
+
 // Unlike the old implementation, we go half-duplex: we don't listen while sending, and vice versa.
 inline void speak() {
 	TX_ENABLE_PIN.setValue(true);
@@ -50,7 +67,7 @@ inline void listen() {
 	TX_ENABLE_PIN.setValue(false);
 }
 
-UART::UART() : enabled(false) {
+UART::UART() : enabled(false), rate(BaudRate::BAUD_38400) {
     UBRR0H = UBRR_VALUE >> 8;
     UBRR0L = UBRR_VALUE & 0xff;
     /* set config for uart, explicitly clear TX interrupt flag */
@@ -85,6 +102,7 @@ void UART::beginSend() {
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
 		uint8_t send_byte = out.getNextByteToSend();
 		speak();
+		transmitting = true;
 		loopback_bytes = 1;
 		UDR0 = send_byte;
 	}
@@ -99,6 +117,18 @@ void UART::enable(bool enabled_in) {
 	}
 }
 
+void UART::setRate(uint8_t rate_in) {
+	if (rate_in >= BaudRate::COUNT) { return; }
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		rate = rate_in;
+		if (transmitting) {
+			pending_rate = rate_in;
+		} else {
+			applyRate(rate_in);
+		}
+	}
+}
+
 volatile uint8_t in_byte;
 // Send and receive interrupts
 ISR(USART_RX_vect)
@@ -118,6 +148,11 @@ ISR(USART_TX_vect)
 		UDR0 = UART::getHostUART().out.getNextByteToSend();
 	} else {
 		listen();
+		transmitting = false;
+		if (pending_rate != NO_PENDING_RATE) {
+			applyRate(pending_rate);
+			pending_rate = NO_PENDING_RATE;
+		}
 	}
 }
 
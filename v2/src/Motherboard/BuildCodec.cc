@@ -0,0 +1,237 @@
+/*
+ * Copyright 2010 by Adam Mayer <adam@makerbot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "BuildCodec.hh"
+#include "Commands.hh"
+
+#define TOKEN_LITERAL  0x00
+#define TOKEN_NEW      0x40
+#define TOKEN_EXT      0x80
+#define TOKEN_ABS      0xC0
+#define TOKEN_TYPE     0xC0
+#define TOKEN_TIMING   0x20
+#define TOKEN_AXES     0x1f
+
+void BuildCodecState::reset() {
+	for (uint8_t i = 0; i < BUILD_AXIS_COUNT; i++) {
+		coordinates[i] = 0;
+	}
+	us = 0;
+	dda = 0;
+	relative = 0;
+}
+
+namespace {
+
+uint8_t* writeVarint(uint8_t* out, uint32_t value) {
+	while (value >= 0x80) {
+		*out++ = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	*out++ = value;
+	return out;
+}
+
+void write32(uint8_t* out, uint32_t value) {
+	for (uint8_t i = 0; i < 4; i++) {
+		out[i] = value & 0xff;
+		value >>= 8;
+	}
+}
+
+/// Reads the fields of a token, keeping track of whether it ran past the
+/// end of the data.
+class TokenReader {
+	const uint8_t* data;
+	uint16_t remaining;
+public:
+	bool overrun;
+	TokenReader(const uint8_t* data_in, uint16_t length) :
+		data(data_in), remaining(length), overrun(false) {}
+	uint8_t read8() {
+		if (remaining == 0) {
+			overrun = true;
+			return 0;
+		}
+		remaining--;
+		return *data++;
+	}
+	uint16_t getRemaining() const { return remaining; }
+	uint32_t readVarint() {
+		uint32_t value = 0;
+		for (uint8_t shift = 0; shift < 35; shift += 7) {
+			const uint8_t b = read8();
+			value |= (uint32_t)(b & 0x7f) << shift;
+			if ((b & 0x80) == 0) {
+				return value;
+			}
+		}
+		overrun = true;
+		return 0;
+	}
+};
+
+} // namespace
+
+uint8_t BuildEncoder::encode(const Packet& packet, uint8_t* token) {
+	const uint8_t command = packet.read8(0);
+	const uint8_t length = packet.getLength();
+	uint8_t type;
+	uint8_t axes;
+	if (command == HOST_CMD_QUEUE_POINT_NEW && length == 26) {
+		type = TOKEN_NEW;
+		axes = 5;
+	} else if (command == HOST_CMD_QUEUE_POINT_EXT && length == 25) {
+		type = TOKEN_EXT;
+		axes = 5;
+	} else if (command == HOST_CMD_QUEUE_POINT_ABS && length == 17) {
+		type = TOKEN_ABS;
+		axes = 3;
+	} else {
+		token[0] = TOKEN_LITERAL;
+		token[1] = length;
+		for (uint8_t i = 0; i < length; i++) {
+			token[2 + i] = packet.read8(i);
+		}
+		return length + 2;
+	}
+	uint8_t flags = 0;
+	uint8_t* out = token + 1;
+	for (uint8_t i = 0; i < axes; i++) {
+		const int32_t value = packet.read32(1 + i*4);
+		const int32_t delta = (uint32_t)value - (uint32_t)coordinates[i];
+		if (delta != 0) {
+			flags |= 1 << i;
+			out = writeVarint(out, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+			coordinates[i] = value;
+		}
+	}
+	const uint32_t timing = packet.read32(1 + axes*4);
+	if (type == TOKEN_NEW) {
+		const uint8_t new_relative = packet.read8(25);
+		if (timing != us || new_relative != relative) {
+			flags |= TOKEN_TIMING;
+			out = writeVarint(out, timing);
+			*out++ = new_relative;
+			us = timing;
+			relative = new_relative;
+		}
+	} else if (timing != dda) {
+		flags |= TOKEN_TIMING;
+		out = writeVarint(out, timing);
+		dda = timing;
+	}
+	token[0] = type | flags;
+	return out - token;
+}
+
+uint8_t BuildDecoder::decode(const uint8_t* data, uint16_t length,
+		uint8_t* command, uint8_t& command_length) {
+	TokenReader reader(data, length);
+	const uint8_t token = reader.read8();
+	const uint8_t type = token & TOKEN_TYPE;
+	if (token == TOKEN_LITERAL) {
+		if (length < 2) {
+			// A single zero byte left in a block is padding.
+			command_length = 0;
+			return length;
+		}
+		command_length = reader.read8();
+		if (command_length > BUILD_MAX_COMMAND) {
+			return 0;
+		}
+		for (uint8_t i = 0; i < command_length; i++) {
+			command[i] = reader.read8();
+		}
+		return reader.overrun ? 0 : command_length + 2;
+	}
+	uint8_t axes = 5;
+	if (type == TOKEN_NEW) {
+		command[0] = HOST_CMD_QUEUE_POINT_NEW;
+		command_length = 26;
+	} else if (type == TOKEN_EXT) {
+		command[0] = HOST_CMD_QUEUE_POINT_EXT;
+		command_length = 25;
+	} else if (type == TOKEN_ABS && (token & TOKEN_AXES) < (1 << 3)) {
+		command[0] = HOST_CMD_QUEUE_POINT_ABS;
+		command_length = 17;
+		axes = 3;
+	} else {
+		return 0;
+	}
+	for (uint8_t i = 0; i < axes; i++) {
+		if ((token & (1 << i)) != 0) {
+			const uint32_t zigzag = reader.readVarint();
+			coordinates[i] += (zigzag >> 1) ^ -(zigzag & 1);
+		}
+		write32(command + 1 + i*4, coordinates[i]);
+	}
+	if (type == TOKEN_NEW) {
+		if ((token & TOKEN_TIMING) != 0) {
+			us = reader.readVarint();
+			relative = reader.read8();
+		}
+		write32(command + 21, us);
+		command[25] = relative;
+	} else {
+		if ((token & TOKEN_TIMING) != 0) {
+			dda = reader.readVarint();
+		}
+		write32(command + 1 + axes*4, dda);
+	}
+	return reader.overrun ? 0 : length - reader.getRemaining();
+}
+
+void BuildBlockPacker::reset(bool close_early_in) {
+	close_early = close_early_in;
+	length = 0;
+}
+
+void BuildBlockPacker::close() {
+	// A single byte of padding is allowed for by the decoder.
+	for (uint16_t i = length; i < BUILD_BLOCK_DATA; i++) {
+		block[i] = 0;
+	}
+	length = BUILD_BLOCK_DATA;
+}
+
+bool BuildBlockPacker::add(const Packet& command, uint32_t offset) {
+	if (isClosed()) {
+		return false;
+	}
+	uint8_t token[BUILD_MAX_TOKEN];
+	if (length == 0) {
+		// Each block starts with the offset of its first command.
+		write32(block, offset);
+		length = sizeof(offset);
+		encoder.reset();
+	}
+	// The encoding depends on the moves before it in the block, so a
+	// command that doesn't fit is encoded again for the next one.
+	const uint8_t token_length = encoder.encode(command, token);
+	if (length + token_length > BUILD_BLOCK_DATA) {
+		close();
+		return false;
+	}
+	for (uint8_t i = 0; i < token_length; i++) {
+		block[length++] = token[i];
+	}
+	if (close_early && length + BUILD_MAX_TOKEN > BUILD_BLOCK_DATA) {
+		close();
+	}
+	return true;
+}
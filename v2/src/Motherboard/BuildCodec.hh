@@ -0,0 +1,115 @@
+/*
+ * Copyright 2010 by Adam Mayer <adam@makerbot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef BUILD_CODEC_HH_
+#define BUILD_CODEC_HH_
+
+#include <stdint.h>
+#include "Packet.hh"
+#include "BuildFile.hh"
+
+/**
+ * Packed encoding of the command stream in a build file.  Each command is
+ * stored as one token:
+ *
+ *   0x00 n <n bytes>   The command, as is (n at most BUILD_MAX_COMMAND)
+ *   0x40 | flags       HOST_CMD_QUEUE_POINT_NEW
+ *   0x80 | flags       HOST_CMD_QUEUE_POINT_EXT
+ *   0xC0 | flags       HOST_CMD_QUEUE_POINT_ABS
+ *
+ * For the moves, bit N of the low five flag bits is set if coordinate N
+ * differs from the last move, and its difference follows as a zigzag
+ * varint.  If bit 0x20 is set, the move's timing follows as a varint (and,
+ * for HOST_CMD_QUEUE_POINT_NEW, its relative axis byte); otherwise it is
+ * the same as the last move of that kind.  Varints are little-endian
+ * base 128, with the top bit of each byte set if another follows.
+ *
+ * The coordinates and timing carried over between moves start at zero at
+ * the start of each block, so that blocks can be decoded on their own.
+ *
+ * Blocks are padded out with zeros.  Padding decodes as empty literals,
+ * except that a single zero byte at the end of a block, too short for a
+ * literal, is taken as an empty command too.
+ */
+
+/// Largest command that can be encoded or decoded
+#define BUILD_MAX_COMMAND MAX_PACKET_PAYLOAD
+/// Largest token the encoder writes
+#define BUILD_MAX_TOKEN (BUILD_MAX_COMMAND + 2)
+
+/// State carried over from one move to the next, shared by the encoder
+/// and decoder.
+class BuildCodecState {
+protected:
+	int32_t coordinates[BUILD_AXIS_COUNT];
+	uint32_t us;
+	uint32_t dda;
+	uint8_t relative;
+public:
+	BuildCodecState() { reset(); }
+	/// Forget the previous moves, as at the start of a block.
+	void reset();
+};
+
+class BuildEncoder : public BuildCodecState {
+public:
+	/// Encode the command in the given packet into the buffer, which
+	/// must hold BUILD_MAX_TOKEN bytes.  Returns the encoded length.
+	uint8_t encode(const Packet& packet, uint8_t* token);
+};
+
+class BuildDecoder : public BuildCodecState {
+public:
+	/// Decode the token at the start of the given data into the command
+	/// buffer, which must hold BUILD_MAX_COMMAND bytes, and set
+	/// command_length to the command's length.  Returns the number of
+	/// bytes of data used, or 0 if the token is malformed or incomplete.
+	uint8_t decode(const uint8_t* data, uint16_t length, uint8_t* command,
+			uint8_t& command_length);
+};
+
+/// Packs commands into the blocks of a packed build file, one block at a
+/// time, in a buffer of BUILD_BLOCK_DATA bytes.  Tokens don't span blocks,
+/// so a block that can't take the next token is closed: padded out with
+/// zeros to its full size, ready to write.  The block CRC is left to the
+/// caller.
+class BuildBlockPacker {
+	BuildEncoder encoder;
+	uint8_t* block;
+	uint16_t length;
+	bool close_early;
+	void close();
+public:
+	BuildBlockPacker(uint8_t* block_in) :
+		block(block_in), length(0), close_early(false) {}
+	/// Start packing a new file.  If close_early is set, a block is
+	/// closed as soon as the longest token might not fit in the rest of
+	/// it, rather than when the next token doesn't.
+	void reset(bool close_early_in);
+	/// Add the command at the given offset of the command stream to the
+	/// block.  Returns false, without adding it, if the block is closed;
+	/// write the block out and clear() the packer first.
+	bool add(const Packet& command, uint32_t offset);
+	/// True if the block is padded out to its full size.
+	bool isClosed() const { return length == BUILD_BLOCK_DATA; }
+	/// Length of the block so far, or 0 if none is started.
+	uint16_t getLength() const { return length; }
+	/// Drop the block, once it has been written out.
+	void clear() { length = 0; }
+};
+
+#endif // BUILD_CODEC_HH_
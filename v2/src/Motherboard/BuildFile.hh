@@ -0,0 +1,90 @@
+/*
+ * Copyright 2010 by Adam Mayer <adam@makerbot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef BUILD_FILE_HH_
+#define BUILD_FILE_HH_
+
+#include <stdint.h>
+
+/**
+ * Layout of an indexed build file on the SD card.  All values are
+ * little-endian, like the host protocol.
+ *
+ * The first block holds a BuildHeader, followed at BUILD_INDEX_OFFSET by
+ * up to BUILD_INDEX_SIZE BuildIndexEntry records.  The command stream
+ * follows in blocks of BUILD_BLOCK_SIZE bytes: BUILD_BLOCK_DATA bytes of
+ * commands, then a CRC-16 (as computed by _crc16_update(), starting from
+ * zero) of those bytes.  The last block may be short, but still ends with
+ * its CRC.  Offsets into the build are offsets in the command stream as
+ * sent to the machine, whatever the encoding.
+ *
+ * Files without a header are played back as a raw command stream.
+ */
+
+#define BUILD_FILE_MAGIC   0x444c424dUL // "MBLD"
+#define BUILD_FILE_VERSION 1
+
+#define BUILD_BLOCK_SIZE   512
+#define BUILD_BLOCK_DATA   (BUILD_BLOCK_SIZE - 2)
+
+/// The command stream as it is sent to the machine
+#define BUILD_ENCODING_PLAIN  0
+/// The command stream packed as described in BuildCodec.hh.  Each block
+/// starts with the offset in the command stream of its first command, as
+/// a uint32_t, and holds whole tokens.  Blocks other than the last are
+/// padded out with zeros, which decode as an empty command.
+#define BUILD_ENCODING_PACKED 1
+
+/// byte_count of a capture that was never finished
+#define BUILD_LENGTH_UNKNOWN 0xffffffffUL
+
+/// Number of axis positions recorded in each index entry, whatever the
+/// number of axes on the board that wrote it.
+#define BUILD_AXIS_COUNT   5
+
+#define BUILD_INDEX_OFFSET 32
+#define BUILD_INDEX_SIZE   16
+
+struct BuildHeader {
+	uint32_t magic;
+	uint8_t version;
+	/// Number of valid entries in the seek index
+	uint8_t index_count;
+	/// Least number of commands between index entries
+	uint16_t index_spacing;
+	/// Number of commands in the build
+	uint32_t command_count;
+	/// Length of the command stream, not counting the header and CRCs
+	uint32_t byte_count;
+	/// Estimated build time in seconds
+	uint32_t duration;
+	/// How the command stream is stored
+	uint8_t encoding;
+} __attribute__ ((__packed__));
+
+/// A point in the build that playback can start from.  Entries are
+/// recorded at layer changes, so each one is the start of a layer.
+struct BuildIndexEntry {
+	/// Offset of the command in the command stream
+	uint32_t offset;
+	/// Number of commands before this one
+	uint32_t command;
+	/// Machine position before the command is run
+	int32_t position[BUILD_AXIS_COUNT];
+} __attribute__ ((__packed__));
+
+#endif // BUILD_FILE_HH_
@@ -0,0 +1,396 @@
+/*
+ * Copyright 2010 by Adam Mayer <adam@makerbot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "Checkpoint.hh"
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include <string.h>
+#include "EepromMap.hh"
+#include "Command.hh"
+#include "Commands.hh"
+#include "Steppers.hh"
+#include "Tool.hh"
+#include "Timeout.hh"
+
+namespace checkpoint {
+
+/// Time between checkpoints.  Each one is written to the next of
+/// CHECKPOINT_SLOTS records in turn, so a given EEPROM byte is rewritten
+/// at most once every CHECKPOINT_SLOTS intervals.
+#ifndef CHECKPOINT_INTERVAL_MS
+#define CHECKPOINT_INTERVAL_MS 30000
+#endif
+#define CHECKPOINT_INTERVAL_MICROS (1000L*CHECKPOINT_INTERVAL_MS)
+
+#define CHECKPOINT_SLOTS 3
+#define CHECKPOINT_TOOL_STATES 6
+#define CHECKPOINT_NAME_SIZE 32
+
+/// Delay between tool status checks while waiting for the tool to heat
+#define RESUME_PING_DELAY_MS 100
+
+/// The last setting of one kind made on a tool
+struct ToolState {
+	uint8_t tool;
+	/// Slave command code, or 0 if the state is unused
+	uint8_t command;
+	uint8_t length;
+	uint8_t payload[4];
+} __attribute__ ((__packed__));
+
+struct Record {
+	/// Build number, matching eeprom::CHECKPOINT_BUILD
+	uint8_t build;
+	/// The newest valid record is the one to resume from
+	uint8_t sequence;
+	/// Offset in the command stream of the move to resume from
+	uint32_t offset;
+	/// Machine position before the move
+	int32_t position[BUILD_AXIS_COUNT];
+	uint8_t tool;
+	ToolState tool_states[CHECKPOINT_TOOL_STATES];
+	uint8_t crc;
+} __attribute__ ((__packed__));
+
+/// Checkpoint state of the build being played back
+Record current;
+/// Copy of the checkpoint being written to EEPROM
+Record pending;
+bool writing = false;
+uint8_t pending_slot;
+uint8_t pending_index;
+uint8_t next_slot = 0;
+
+/// The build number and filename are written by runCheckpointSlice() too:
+/// first the build number is cleared, so the old records can't be taken
+/// for this build's, then the name is written, then the build number.
+/// Records wait for them.
+bool header_pending = false;
+/// 0 to clear the build number, 1 to CHECKPOINT_NAME_SIZE for the name,
+/// then the build number
+uint8_t header_index;
+char pending_name[CHECKPOINT_NAME_SIZE];
+
+/// True while checkpointing a build
+bool active = false;
+/// Offset that playback started from
+uint32_t start_offset;
+Timeout interval;
+
+uint8_t recordCrc(const Record& record) {
+	const uint8_t* data = (const uint8_t*)&record;
+	uint8_t crc = 0;
+	for (uint8_t i = 0; i < sizeof(Record) - 1; i++) {
+		crc = _crc_ibutton_update(crc, data[i]);
+	}
+	return crc;
+}
+
+inline uint8_t* slotAddress(uint8_t slot) {
+	return (uint8_t*)(eeprom::CHECKPOINT_RECORDS + slot * sizeof(Record));
+}
+
+/// Start writing the current checkpoint to the next record.
+void stage() {
+	current.sequence++;
+	current.crc = recordCrc(current);
+	pending = current;
+	pending_slot = next_slot;
+	pending_index = 0;
+	next_slot = (next_slot + 1) % CHECKPOINT_SLOTS;
+	writing = true;
+}
+
+void start(const char* filename, uint32_t offset) {
+	// The build number in EEPROM is out of date while a header is pending.
+	uint8_t build = header_pending ? current.build :
+			eeprom_read_byte((uint8_t*)eeprom::CHECKPOINT_BUILD);
+	if (++build == 0xff) {
+		build = 0;
+	}
+	writing = false;
+	memset(pending_name, 0, CHECKPOINT_NAME_SIZE);
+	strncpy(pending_name, filename, CHECKPOINT_NAME_SIZE - 1);
+	header_index = 0;
+	header_pending = true;
+
+	memset(&current, 0, sizeof(current));
+	current.build = build;
+	start_offset = offset;
+	interval.start(CHECKPOINT_INTERVAL_MICROS);
+	active = true;
+}
+
+void noteMove(uint32_t offset) {
+	if (!active || writing) {
+		return;
+	}
+	// Moves queued ahead of the playback, by resume(), come before the
+	// start offset.
+	if ((int32_t)(offset - start_offset) < 0) {
+		return;
+	}
+	if (!interval.hasElapsed()) {
+		return;
+	}
+	interval.start(CHECKPOINT_INTERVAL_MICROS);
+	const Point position = steppers::getPosition();
+	for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+		current.position[i] = position[i];
+	}
+	current.offset = offset;
+	current.tool = tool::tool_index;
+	stage();
+}
+
+void noteToolCommand(const Packet& packet) {
+	if (!active) {
+		return;
+	}
+	const uint8_t tool = packet.read8(0);
+	const uint8_t command = packet.read8(1);
+	const uint8_t length = packet.getLength() - 2;
+	switch (command) {
+	case SLAVE_CMD_SET_TEMP:
+	case SLAVE_CMD_SET_PLATFORM_TEMP:
+	case SLAVE_CMD_SET_MOTOR_1_PWM:
+	case SLAVE_CMD_SET_MOTOR_1_RPM:
+	case SLAVE_CMD_SET_MOTOR_1_DIR:
+	case SLAVE_CMD_TOGGLE_MOTOR_1:
+	case SLAVE_CMD_TOGGLE_FAN:
+	case SLAVE_CMD_TOGGLE_VALVE:
+		break;
+	default:
+		return;
+	}
+	if (length > sizeof(current.tool_states[0].payload)) {
+		return;
+	}
+	ToolState* state = 0;
+	for (uint8_t i = 0; i < CHECKPOINT_TOOL_STATES; i++) {
+		ToolState& s = current.tool_states[i];
+		if (s.command == command && s.tool == tool) {
+			state = &s;
+			break;
+		}
+		if (s.command == 0 && state == 0) {
+			state = &s;
+		}
+	}
+	if (state == 0) {
+		return;
+	}
+	state->tool = tool;
+	state->command = command;
+	state->length = length;
+	for (uint8_t i = 0; i < length; i++) {
+		state->payload[i] = packet.read8(2 + i);
+	}
+}
+
+void finish() {
+	if (!active) {
+		return;
+	}
+	active = false;
+	writing = false;
+	header_pending = false;
+	eeprom_write_byte((uint8_t*)eeprom::CHECKPOINT_BUILD, 0xff);
+}
+
+/// Write the next byte of the pending build number and filename that
+/// differs from what is in EEPROM.  The same file is often run again.
+void writeHeaderByte() {
+	while (header_index <= CHECKPOINT_NAME_SIZE + 1) {
+		uint8_t* address;
+		uint8_t value;
+		if (header_index == 0) {
+			address = (uint8_t*)eeprom::CHECKPOINT_BUILD;
+			value = 0xff;
+		} else if (header_index <= CHECKPOINT_NAME_SIZE) {
+			address = (uint8_t*)eeprom::CHECKPOINT_FILENAME + header_index - 1;
+			value = pending_name[header_index - 1];
+		} else {
+			address = (uint8_t*)eeprom::CHECKPOINT_BUILD;
+			value = current.build;
+		}
+		header_index++;
+		if (eeprom_read_byte(address) != value) {
+			eeprom_write_byte(address, value);
+			return;
+		}
+	}
+	header_pending = false;
+}
+
+void runCheckpointSlice() {
+	if (!eeprom_is_ready()) {
+		return;
+	}
+	if (header_pending) {
+		writeHeaderByte();
+		return;
+	}
+	if (!writing) {
+		return;
+	}
+	uint8_t* address = slotAddress(pending_slot) + pending_index;
+	const uint8_t value = ((const uint8_t*)&pending)[pending_index];
+	if (eeprom_read_byte(address) != value) {
+		eeprom_write_byte(address, value);
+	}
+	if (++pending_index == sizeof(Record)) {
+		writing = false;
+	}
+}
+
+/// Find the newest complete record of the checkpointed build.
+bool readNewest(Record& record) {
+	const uint8_t build = eeprom_read_byte((uint8_t*)eeprom::CHECKPOINT_BUILD);
+	if (build == 0xff) {
+		return false;
+	}
+	bool found = false;
+	for (uint8_t slot = 0; slot < CHECKPOINT_SLOTS; slot++) {
+		eeprom_read_block(&pending, slotAddress(slot), sizeof(Record));
+		if (pending.build != build || pending.crc != recordCrc(pending)) {
+			continue;
+		}
+		if (!found || (int8_t)(pending.sequence - record.sequence) > 0) {
+			record = pending;
+			found = true;
+		}
+	}
+	return found;
+}
+
+void push16(uint16_t value) {
+	command::push(value & 0xff);
+	command::push(value >> 8);
+}
+
+void push32(uint32_t value) {
+	push16(value & 0xffff);
+	push16(value >> 16);
+}
+
+void pushMove(int32_t x, int32_t y, int32_t z, const Record& record,
+		uint32_t us_per_step) {
+	command::push(HOST_CMD_QUEUE_POINT_EXT);
+	push32(x);
+	push32(y);
+	push32(z);
+	push32(record.position[3]);
+	push32(record.position[4]);
+	push32(us_per_step);
+}
+
+sdcard::SdErrorCode resume(uint8_t min_axes, uint8_t max_axes,
+		uint32_t us_per_step, uint16_t timeout_s, const int32_t* home) {
+	// Resuming replaces the command queue, so don't cut into a build or
+	// move that is still running.
+	if (sdcard::isPlaying() || sdcard::isCapturing() ||
+			!command::isEmpty() || steppers::isRunning()) {
+		return sdcard::SD_ERR_BUSY;
+	}
+	writing = false;
+	Record record;
+	if (!readNewest(record)) {
+		return sdcard::SD_ERR_NO_CHECKPOINT;
+	}
+	char name[CHECKPOINT_NAME_SIZE];
+	eeprom_read_block(name, (const uint8_t*)eeprom::CHECKPOINT_FILENAME,
+			CHECKPOINT_NAME_SIZE);
+	name[CHECKPOINT_NAME_SIZE - 1] = '\0';
+	sdcard::SdErrorCode result = sdcard::startPlaybackFrom(name, record.offset);
+	if (result != sdcard::SD_SUCCESS) {
+		return result;
+	}
+	// Carry the checkpoint over to the resumed build straight away, in case
+	// it is cut short again.
+	start(name, record.offset);
+	record.build = current.build;
+	record.sequence = 0;
+	current = record;
+	stage();
+
+	// Queue up the commands that bring the machine back to the checkpoint.
+	// Playback fills the queue behind them.
+	command::reset();
+	bool platform = false;
+	uint8_t platform_tool = 0;
+	for (uint8_t i = 0; i < CHECKPOINT_TOOL_STATES; i++) {
+		const ToolState& state = record.tool_states[i];
+		if (state.command == 0) {
+			continue;
+		}
+		if (state.command == SLAVE_CMD_SET_PLATFORM_TEMP) {
+			platform = true;
+			platform_tool = state.tool;
+		}
+		command::push(HOST_CMD_TOOL_COMMAND);
+		command::push(state.tool);
+		command::push(state.command);
+		command::push(state.length);
+		for (uint8_t j = 0; j < state.length; j++) {
+			command::push(state.payload[j]);
+		}
+	}
+	command::push(HOST_CMD_CHANGE_TOOL);
+	command::push(record.tool);
+	if (max_axes != 0) {
+		command::push(HOST_CMD_FIND_AXES_MAXIMUM);
+		command::push(max_axes);
+		push32(us_per_step);
+		push16(timeout_s);
+	}
+	if (min_axes != 0) {
+		command::push(HOST_CMD_FIND_AXES_MINIMUM);
+		command::push(min_axes);
+		push32(us_per_step);
+		push16(timeout_s);
+	}
+	// Axes that weren't homed are taken to be where the checkpoint left
+	// them.
+	int32_t position[3];
+	command::push(HOST_CMD_SET_POSITION_EXT);
+	for (uint8_t i = 0; i < 3; i++) {
+		const bool homed = ((min_axes | max_axes) & (1 << i)) != 0;
+		position[i] = homed ? home[i] : record.position[i];
+		push32(position[i]);
+	}
+	push32(record.position[3]);
+	push32(record.position[4]);
+	command::push(HOST_CMD_WAIT_FOR_TOOL);
+	command::push(record.tool);
+	push16(RESUME_PING_DELAY_MS);
+	push16(timeout_s);
+	if (platform) {
+		command::push(HOST_CMD_WAIT_FOR_PLATFORM);
+		command::push(platform_tool);
+		push16(RESUME_PING_DELAY_MS);
+		push16(timeout_s);
+	}
+	// Move over the part before coming down to it.
+	pushMove(record.position[0], record.position[1], position[2], record,
+			us_per_step);
+	pushMove(record.position[0], record.position[1], record.position[2], record,
+			us_per_step);
+	return sdcard::SD_SUCCESS;
+}
+
+} // namespace checkpoint
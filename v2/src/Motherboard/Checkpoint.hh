@@ -0,0 +1,76 @@
+/*
+ * Copyright 2010 by Adam Mayer <adam@makerbot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef CHECKPOINT_HH_
+#define CHECKPOINT_HH_
+
+#include <stdint.h>
+#include "Packet.hh"
+#include "SDCard.hh"
+
+/// Build checkpoints let an SD card build that was cut short, by a power
+/// failure or an abort, carry on from close to where it stopped.  While a
+/// build plays back, the offset of the move being started, the machine
+/// position and the tool state (temperatures, motor and fan settings) are
+/// saved to EEPROM at intervals.  The checkpoint is cleared when the build
+/// runs to completion.
+namespace checkpoint {
+
+/**
+ * Start checkpointing a build played back from the given file, starting
+ * at the given offset in its command stream.
+ */
+void start(const char* filename, uint32_t offset);
+
+/**
+ * Note that the command at the given offset of the playback stream is a
+ * move about to be started, so the move before it is complete.
+ */
+void noteMove(uint32_t offset);
+
+/**
+ * Note a command sent to a tool during playback, so that the tool's
+ * settings can be restored on resume.
+ */
+void noteToolCommand(const Packet& packet);
+
+/**
+ * Note that the build has run to completion; there is nothing to resume.
+ */
+void finish();
+
+/**
+ * Write any pending checkpoint to EEPROM, a byte at a time so that the
+ * main loop isn't held up.
+ */
+void runCheckpointSlice();
+
+/**
+ * Resume the checkpointed build.  Restores the tool settings, homes the
+ * axes in min_axes and max_axes (as HOST_CMD_FIND_AXES_MINIMUM and
+ * HOST_CMD_FIND_AXES_MAXIMUM) and defines the homed axes to be at the
+ * given home position, waits for the tool to heat, moves to the
+ * checkpointed position and continues playback from there.  Z should
+ * be homed away from the part.  Returns SD_ERR_BUSY unless the machine is
+ * idle, with no playback or capture open.
+ */
+sdcard::SdErrorCode resume(uint8_t min_axes, uint8_t max_axes,
+		uint32_t us_per_step, uint16_t timeout_s, const int32_t* home);
+
+} // namespace checkpoint
+
+#endif // CHECKPOINT_HH_
@@ -24,6 +24,7 @@
 #include "CircularBuffer.hh"
 #include <util/atomic.h>
 #include "SDCard.hh"
+#include "Checkpoint.hh"
 
 namespace command {
 
@@ -35,6 +36,11 @@ bool outstanding_tool_command = false;
 
 bool paused = false;
 
+/// Playback statistics, cleared when a playback starts
+bool was_playing = false;
+uint32_t commands_dispatched = 0;
+uint32_t playback_stalls = 0;
+
 uint16_t getRemainingCapacity() {
 	uint16_t sz;
 	ATOMIC_BLOCK(ATOMIC_FORCEON) {
@@ -51,6 +57,22 @@ bool isPaused() {
 	return paused;
 }
 
+uint16_t getLength() {
+	uint16_t sz;
+	ATOMIC_BLOCK(ATOMIC_FORCEON) {
+		sz = command_buffer.getLength();
+	}
+	return sz;
+}
+
+uint32_t getCommandsDispatched() {
+	return commands_dispatched;
+}
+
+uint32_t getPlaybackStalls() {
+	return playback_stalls;
+}
+
 bool isEmpty() {
 	return command_buffer.isEmpty();
 }
@@ -109,11 +131,34 @@ void reset() {
 	mode = READY;
 }
 
+/// Note the move at the head of the queue for the build checkpoint.
+void checkpointMove() {
+	if (sdcard::isPlaying()) {
+		checkpoint::noteMove(sdcard::playbackPosition() -
+				command_buffer.getLength());
+	}
+}
+
 // A fast slice for processing commands and refilling the stepper queue, etc.
 void runCommandSlice() {
-	if (sdcard::isPlaying()) {
-		while (command_buffer.getRemainingCapacity() > 0 && sdcard::playbackHasNext()) {
-			command_buffer.push(sdcard::playbackNext());
+	const bool playing = sdcard::isPlaying();
+	if (playing && !was_playing) {
+		commands_dispatched = 0;
+		playback_stalls = 0;
+	}
+	was_playing = playing;
+	if (playing) {
+		if (command_buffer.isEmpty() && sdcard::playbackHasNext()) {
+			// The queue ran dry before the card could refill it.
+			playback_stalls++;
+		}
+		sdcard::playbackFill(command_buffer);
+		if (command_buffer.isEmpty() && mode == READY &&
+				!steppers::isRunning() &&
+				sdcard::playbackError() == sdcard::SD_SUCCESS) {
+			// The whole file has been played.  A build cut short by a bad
+			// block keeps its checkpoint, so that it can be resumed.
+			checkpoint::finish();
 		}
 	}
 	if (paused) { return; }
@@ -181,11 +226,13 @@ void runCommandSlice() {
 	}
 	if (mode == READY) {
 		// process next command on the queue.
-		if (command_buffer.getLength() > 0) {
+		const BufSizeType queued = command_buffer.getLength();
+		if (queued > 0) {
 			uint8_t command = command_buffer[0];
 			if (command == HOST_CMD_QUEUE_POINT_ABS) {
 				// check for completion
 				if (command_buffer.getLength() >= 17) {
+					checkpointMove();
 					command_buffer.pop(); // remove the command code
 					mode = MOVING;
 					int32_t x = pop32();
@@ -197,6 +244,7 @@ void runCommandSlice() {
 			} else if (command == HOST_CMD_QUEUE_POINT_EXT) {
 				// check for completion
 				if (command_buffer.getLength() >= 25) {
+					checkpointMove();
 					command_buffer.pop(); // remove the command code
 					mode = MOVING;
 					int32_t x = pop32();
@@ -210,6 +258,7 @@ void runCommandSlice() {
 			} else if (command == HOST_CMD_QUEUE_POINT_NEW) {
 				// check for completion
 				if (command_buffer.getLength() >= 26) {
+					checkpointMove();
 					command_buffer.pop(); // remove the command code
 					mode = MOVING;
 					int32_t x = pop32();
@@ -313,6 +362,9 @@ void runCommandSlice() {
 							for (int i = 0; i < len; i++) {
 								out.append8(command_buffer.pop());
 							}
+							if (sdcard::isPlaying()) {
+								checkpoint::noteToolCommand(out);
+							}
 							// we don't care about the response, so we can release
 							// the lock after we initiate the transfer
 							tool::startTransaction();
@@ -322,6 +374,9 @@ void runCommandSlice() {
 				}
 			} else {
 			}
+			if (command_buffer.getLength() < queued) {
+				commands_dispatched++;
+			}
 		}
 	}
 }
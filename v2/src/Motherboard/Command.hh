@@ -49,6 +49,23 @@ bool isPaused();
  */
 uint16_t getRemainingCapacity();
 
+/**
+ * Return the number of bytes in the command buffer.
+ */
+uint16_t getLength();
+
+/**
+ * Return the number of commands taken off the queue since the current
+ * SD card playback started.
+ */
+uint32_t getCommandsDispatched();
+
+/**
+ * Return the number of times the queue was found empty during the current
+ * SD card playback while the file still had commands to play.
+ */
+uint32_t getPlaybackStalls();
+
 /**
  * Returns true if command queue is empty.
  */
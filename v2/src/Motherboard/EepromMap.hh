@@ -45,6 +45,14 @@ const static uint16_t ENDSTOP_INVERSION			= 0x0003;
 // Name of this machine: 32 bytes.
 const static uint16_t MACHINE_NAME				= 0x0020;
 
+// SD build checkpoint; see Checkpoint.hh.
+// Number of the checkpointed build: 1 byte, 0xff if there is none.
+const static uint16_t CHECKPOINT_BUILD			= 0x0100;
+// Name of the checkpointed build file: 32 bytes.
+const static uint16_t CHECKPOINT_FILENAME		= 0x0101;
+// Checkpoint records: 3 records of 70 bytes.
+const static uint16_t CHECKPOINT_RECORDS		= 0x0121;
+
 void init();
 
 uint8_t getEeprom8(const uint16_t location, const uint8_t default_value);
@@ -33,5 +33,6 @@
 #define ERR_WDT_TIMEOUT				6
 
 #define ERR_HOST_TRUNCATED_CMD		8
+#define ERR_SD_BAD_BLOCK			9
 
 #endif /* ERRORS_HH_ */
@@ -28,6 +28,8 @@
 #include "Main.hh"
 #include "Errors.hh"
 #include "SDCard.hh"
+#include "Checkpoint.hh"
+#include <string.h>
 
 /// Identify a command packet, and process it.  If the packet is a command
 /// packet, return true, indicating that the packet has been queued and no
@@ -45,8 +47,34 @@ Timeout packet_in_timeout;
 #define HOST_TOOL_RESPONSE_TIMEOUT_MS 50
 #define HOST_TOOL_RESPONSE_TIMEOUT_MICROS (1000L*HOST_TOOL_RESPONSE_TIMEOUT_MS)
 
+// After switching rates the host must send a valid packet at the new rate
+// within this window, or we revert to the old rate.
+#define HOST_BAUD_RATE_CONFIRM_MS 1000L
+#define HOST_BAUD_RATE_CONFIRM_MICROS (1000L*HOST_BAUD_RATE_CONFIRM_MS)
+// Consecutive receive errors at a confirmed non-default rate after which we
+// assume a new host is talking to us at the default rate.
+#define HOST_BAUD_RATE_MAX_ERRORS 4
+
 bool do_host_reset = false;
 
+// Rate change requested by the last packet, applied once the response has
+// been sent.
+#define NO_BAUD_RATE_CHANGE 0xff
+uint8_t new_baud_rate = NO_BAUD_RATE_CHANGE;
+// Rate to return to if the host doesn't confirm the new one.
+uint8_t previous_baud_rate;
+// Set while a rate change awaits its first valid packet.
+bool baud_rate_unconfirmed = false;
+Timeout baud_rate_confirm_timeout;
+uint8_t baud_rate_errors = 0;
+
+/// Return to the given rate and forget any pending confirmation.
+void revertBaudRate(uint8_t rate) {
+	Motherboard::getBoard().getHostUART().setRate(rate);
+	baud_rate_unconfirmed = false;
+	baud_rate_errors = 0;
+}
+
 void runHostSlice() {
 	InPacket& in = Motherboard::getBoard().getHostUART().in;
 	OutPacket& out = Motherboard::getBoard().getHostUART().out;
@@ -61,6 +89,9 @@ void runHostSlice() {
 		packet_in_timeout.abort();
 		return;
 	}
+	if (baud_rate_unconfirmed && baud_rate_confirm_timeout.hasElapsed()) {
+		revertBaudRate(previous_baud_rate);
+	}
 	if (in.isStarted() && !in.isFinished()) {
 		if (!packet_in_timeout.isActive()) {
 			// initiate timeout
@@ -70,6 +101,11 @@ void runHostSlice() {
 		}
 	}
 	if (in.hasError()) {
+		if (!baud_rate_unconfirmed &&
+				Motherboard::getBoard().getHostUART().getRate() != HOST_DEFAULT_BAUD_RATE &&
+				++baud_rate_errors >= HOST_BAUD_RATE_MAX_ERRORS) {
+			revertBaudRate(HOST_DEFAULT_BAUD_RATE);
+		}
 		// Reset packet quickly and start handling the next packet.
 		// Report error code.
 		if (in.getErrorCode() == PacketError::PACKET_TIMEOUT) {
@@ -81,6 +117,9 @@ void runHostSlice() {
 	}
 	if (in.isFinished()) {
 		packet_in_timeout.abort();
+		// Any valid packet shows that the current rate works.
+		baud_rate_unconfirmed = false;
+		baud_rate_errors = 0;
 		out.reset();
 #if defined(HONOR_DEBUG_PACKETS) && (HONOR_DEBUG_PACKETS == 1)
 		if (processDebugPacket(in, out)) {
@@ -96,7 +135,16 @@ void runHostSlice() {
 			out.append8(RC_CMD_UNSUPPORTED);
 		}
 		in.reset();
-		Motherboard::getBoard().getHostUART().beginSend();
+		UART& uart = Motherboard::getBoard().getHostUART();
+		uart.beginSend();
+		if (new_baud_rate != NO_BAUD_RATE_CHANGE) {
+			// Takes effect once the response has been sent.
+			previous_baud_rate = uart.getRate();
+			uart.setRate(new_baud_rate);
+			baud_rate_unconfirmed = true;
+			baud_rate_confirm_timeout.start(HOST_BAUD_RATE_CONFIRM_MICROS);
+			new_baud_rate = NO_BAUD_RATE_CHANGE;
+		}
 	}
 }
 
@@ -109,26 +157,34 @@ bool processCommandPacket(const InPacket& from_host, OutPacket& to_host) {
 		uint8_t command = from_host.read8(0);
 		if ((command & 0x80) != 0) {
 			// If we're capturing a file to an SD card, we send it to the sdcard module
-			// for processing.
-			if (sdcard::isCapturing()) {
+			// for processing.  In tee mode it is queued as well.
+			const bool teeing = sdcard::isTeeing();
+			if (sdcard::isCapturing() && !teeing) {
 				sdcard::capturePacket(from_host);
 				to_host.append8(RC_OK);
 				return true;
 			}
 			// Queue command, if there's room.
 			// Turn off interrupts while querying or manipulating the queue!
+			bool queued = false;
 			ATOMIC_BLOCK(ATOMIC_FORCEON) {
 				const uint8_t command_length = from_host.getLength();
-				if (command::getRemainingCapacity() >= command_length) {
+				if (command::getRemainingCapacity() >= command_length &&
+						(!teeing || sdcard::captureHasRoom())) {
 					// Append command to buffer
 					for (int i = 0; i < command_length; i++) {
 						command::push(from_host.read8(i));
 					}
+					queued = true;
 					to_host.append8(RC_OK);
 				} else {
 					to_host.append8(RC_BUFFER_OVERFLOW);
 				}
 			}
+			// Capture with interrupts on; it may write to the card.
+			if (queued && teeing) {
+				sdcard::capturePacket(from_host);
+			}
 			return true;
 		}
 	}
@@ -203,7 +259,31 @@ inline void handleGetPositionExt(const InPacket& from_host, OutPacket& to_host)
 inline void handleCaptureToFile(const InPacket& from_host, OutPacket& to_host) {
 	char *p = (char*)from_host.getData() + 1;
 	to_host.append8(RC_OK);
-	to_host.append8(sdcard::startCapture(p));
+	to_host.append8(sdcard::startCapture(p,false));
+}
+
+/// Like handleCaptureToFile, but the captured commands are run as well.
+inline void handleTeeToFile(const InPacket& from_host, OutPacket& to_host) {
+	char *p = (char*)from_host.getData() + 1;
+	to_host.append8(RC_OK);
+	to_host.append8(sdcard::startCapture(p,true));
+}
+
+/// Builds played from a playlist aren't checkpointed, so stop checkpointing
+/// the build that was playing before, if any.
+inline void handlePlayPlaylist(const InPacket& from_host, OutPacket& to_host) {
+	const int MAX_FILE_LEN = MAX_PACKET_PAYLOAD-1;
+	to_host.append8(RC_OK);
+	char fnbuf[MAX_FILE_LEN];
+	for (int idx = 1; idx < from_host.getLength(); idx++) {
+		fnbuf[idx-1] = from_host.read8(idx);
+	}
+	fnbuf[MAX_FILE_LEN-1] = '\0';
+	sdcard::SdErrorCode e = sdcard::startPlaylist(fnbuf);
+	if (e == sdcard::SD_SUCCESS) {
+		checkpoint::finish();
+	}
+	to_host.append8(e);
 }
 
 inline void handleEndCapture(const InPacket& from_host, OutPacket& to_host) {
@@ -219,7 +299,95 @@ inline void handlePlayback(const InPacket& from_host, OutPacket& to_host) {
 		fnbuf[idx-1] = from_host.read8(idx);
 	}
 	fnbuf[MAX_FILE_LEN-1] = '\0';
-	to_host.append8(sdcard::startPlayback(fnbuf));
+	sdcard::SdErrorCode e = sdcard::startPlayback(fnbuf);
+	if (e == sdcard::SD_SUCCESS) {
+		checkpoint::start(fnbuf,0);
+	}
+	to_host.append8(e);
+}
+
+inline void handleGetBuildInfo(const InPacket& from_host, OutPacket& to_host) {
+	char *p = (char*)from_host.getData() + 1;
+	BuildHeader header;
+	to_host.append8(RC_OK);
+	to_host.append8(sdcard::getBuildInfo(p,header));
+	to_host.append8(header.version);
+	to_host.append8(header.index_count);
+	to_host.append32(header.command_count);
+	to_host.append32(header.byte_count);
+	to_host.append32(header.duration);
+	to_host.append8(header.encoding);
+}
+
+void appendIndexEntry(const BuildIndexEntry& entry, OutPacket& to_host) {
+	to_host.append32(entry.offset);
+	to_host.append32(entry.command);
+	for (uint8_t i = 0; i < BUILD_AXIS_COUNT; i++) {
+		to_host.append32(entry.position[i]);
+	}
+}
+
+inline void handleGetBuildIndex(const InPacket& from_host, OutPacket& to_host) {
+	char *p = (char*)from_host.getData() + 2;
+	BuildIndexEntry entry;
+	to_host.append8(RC_OK);
+	to_host.append8(sdcard::getBuildIndexEntry(p,from_host.read8(1),entry));
+	appendIndexEntry(entry,to_host);
+}
+
+/// Start playback from a seek index entry.  The machine should already be
+/// at the entry's position; it is defined as the current position, so the
+/// extruder axes carry on from where the build left them.
+inline void handlePlaybackFromIndex(const InPacket& from_host, OutPacket& to_host) {
+	char *p = (char*)from_host.getData() + 2;
+	BuildIndexEntry entry;
+	to_host.append8(RC_OK);
+	sdcard::SdErrorCode e = sdcard::startPlaybackAt(p,from_host.read8(1),entry);
+	if (e == sdcard::SD_SUCCESS) {
+		steppers::definePosition(Point(entry.position[0],entry.position[1],
+				entry.position[2],entry.position[3],entry.position[4]));
+		checkpoint::start(p,entry.offset);
+	}
+	to_host.append8(e);
+}
+
+/// Resume the checkpointed build.  The arguments are the axes to home to
+/// their minimums and maximums, the homing and travel feedrate, the
+/// homing and heating timeout, and the X, Y and Z position of the homed
+/// axes.
+inline void handleResumePlayback(const InPacket& from_host, OutPacket& to_host) {
+	int32_t home[3];
+	for (uint8_t i = 0; i < 3; i++) {
+		home[i] = from_host.read32(9 + i*4);
+	}
+	to_host.append8(RC_OK);
+	to_host.append8(checkpoint::resume(from_host.read8(1),from_host.read8(2),
+			from_host.read32(3),from_host.read16(7),home));
+}
+
+/// Report the progress of the SD card playback: whether a file is playing,
+/// its size on the card, the length of its command stream and the offset
+/// reached in it, the number of commands run, the bytes in use and free in
+/// the command queue, the number of times the queue ran dry, and the SD
+/// error, if any, that stopped the playback early.
+inline void handlePlaybackStatus(const InPacket& from_host, OutPacket& to_host) {
+	to_host.append8(RC_OK);
+	to_host.append8(sdcard::isPlaying()?1:0);
+	to_host.append32(sdcard::playbackFileSize());
+	to_host.append32(sdcard::playbackLength());
+	to_host.append32(sdcard::playbackPosition());
+	to_host.append32(command::getCommandsDispatched());
+	to_host.append16(command::getLength());
+	to_host.append16(command::getRemainingCapacity());
+	to_host.append32(command::getPlaybackStalls());
+	to_host.append8(sdcard::playbackError());
+}
+
+/// Set the speed override, and reply with the override now in effect.
+inline void handleSetSpeedOverride(const InPacket& from_host, OutPacket& to_host) {
+	steppers::setSpeedOverride(from_host.read8(1));
+	to_host.append8(RC_OK);
+	to_host.append8(steppers::getSpeedOverride());
 }
 
 inline void handleNextFilename(const InPacket& from_host, OutPacket& to_host) {
@@ -249,6 +417,45 @@ inline void handleNextFilename(const InPacket& from_host, OutPacket& to_host) {
 	to_host.append8(0);
 }
 
+/// Return a page of directory entries: the SD error code, followed by as
+/// many null-terminated names as fit in the packet.  Names are truncated to
+/// leave room for the header.  An empty name marks the end of the listing.
+inline void handleNextFilenames(const InPacket& from_host, OutPacket& to_host) {
+	to_host.append8(RC_OK);
+	uint8_t resetFlag = from_host.read8(1);
+	if (resetFlag != 0) {
+		sdcard::SdErrorCode e = sdcard::directoryReset();
+		if (e != sdcard::SD_SUCCESS) {
+			to_host.append8(e);
+			to_host.append8(0);
+			return;
+		}
+	}
+	to_host.append8(sdcard::SD_SUCCESS);
+	const uint8_t MAX_FILE_LEN = MAX_PACKET_PAYLOAD-2;
+	char fnbuf[MAX_FILE_LEN];
+	while (true) {
+		sdcard::directoryNextEntry(fnbuf,MAX_FILE_LEN);
+		const uint8_t len = strlen(fnbuf);
+		if (to_host.getLength() + len + 1 > MAX_PACKET_PAYLOAD) {
+			// Doesn't fit; leave it for the next page.
+			sdcard::directoryUnreadEntry();
+			break;
+		}
+		if (fnbuf[0] == '.') {
+			// Ignore dot-files
+			continue;
+		}
+		for (uint8_t idx = 0; idx < len; idx++) {
+			to_host.append8(fnbuf[idx]);
+		}
+		to_host.append8(0);
+		if (len == 0) {
+			break;
+		}
+	}
+}
+
 void doToolPause(OutPacket& to_host) {
 	Timeout acquire_lock_timeout;
 	acquire_lock_timeout.start(HOST_TOOL_RESPONSE_TIMEOUT_MS);
@@ -361,6 +568,39 @@ inline void handleWriteEeprom(const InPacket& from_host, OutPacket& to_host) {
 	to_host.append8(length);
 }
 
+inline void handleGetToolLinkStats(const InPacket& from_host, OutPacket& to_host) {
+	const tool::LinkStats* ls = tool::getLinkStats(from_host.read8(1));
+	if (ls == 0) {
+		to_host.append8(RC_GENERIC_ERROR);
+		return;
+	}
+	to_host.append8(RC_OK);
+	to_host.append8(ls->online?1:0);
+	to_host.append32(ls->srtt_micros);
+	to_host.append32(ls->rttvar_micros);
+	to_host.append32(ls->rto_micros);
+	to_host.append32(ls->transactions);
+	to_host.append16(ls->retries);
+	to_host.append16(ls->crc_errors);
+	to_host.append16(ls->timeouts);
+	to_host.append16(ls->failures);
+}
+
+/// Only rates that 16MHz divides exactly are offered, so that a fast link
+/// isn't let down by divisor error.  The default rate is always accepted so
+/// that the host can switch back.
+inline void handleSetBaudRate(const InPacket& from_host, OutPacket& to_host) {
+	const uint8_t rate = from_host.read8(1);
+	if (rate >= BaudRate::COUNT ||
+			(rate != HOST_DEFAULT_BAUD_RATE &&
+			 ((F_CPU / 8) % baudRateToBps(rate)) != 0)) {
+		to_host.append8(RC_GENERIC_ERROR);
+		return;
+	}
+	new_baud_rate = rate;
+	to_host.append8(RC_OK);
+}
+
 enum { // bit assignments
 	ES_STEPPERS = 0, // stop steppers
 	ES_COMMANDS = 1  // clean queue
@@ -413,6 +653,9 @@ bool processQueryPacket(const InPacket& from_host, OutPacket& to_host) {
 			case HOST_CMD_CAPTURE_TO_FILE:
 				handleCaptureToFile(from_host,to_host);
 				return true;
+			case HOST_CMD_TEE_TO_FILE:
+				handleTeeToFile(from_host,to_host);
+				return true;
 			case HOST_CMD_END_CAPTURE:
 				handleEndCapture(from_host,to_host);
 				return true;
@@ -422,6 +665,30 @@ bool processQueryPacket(const InPacket& from_host, OutPacket& to_host) {
 			case HOST_CMD_NEXT_FILENAME:
 				handleNextFilename(from_host,to_host);
 				return true;
+			case HOST_CMD_GET_NEXT_FILENAMES:
+				handleNextFilenames(from_host,to_host);
+				return true;
+			case HOST_CMD_GET_BUILD_INFO:
+				handleGetBuildInfo(from_host,to_host);
+				return true;
+			case HOST_CMD_GET_BUILD_INDEX:
+				handleGetBuildIndex(from_host,to_host);
+				return true;
+			case HOST_CMD_PLAYBACK_FROM_INDEX:
+				handlePlaybackFromIndex(from_host,to_host);
+				return true;
+			case HOST_CMD_RESUME_PLAYBACK:
+				handleResumePlayback(from_host,to_host);
+				return true;
+			case HOST_CMD_GET_PLAYBACK_STATUS:
+				handlePlaybackStatus(from_host,to_host);
+				return true;
+			case HOST_CMD_PLAY_PLAYLIST:
+				handlePlayPlaylist(from_host,to_host);
+				return true;
+			case HOST_CMD_SET_SPEED_OVERRIDE:
+				handleSetSpeedOverride(from_host,to_host);
+				return true;
 			case HOST_CMD_GET_RANGE:
 			case HOST_CMD_SET_RANGE:
 				break; // not yet implemented
@@ -443,6 +710,12 @@ bool processQueryPacket(const InPacket& from_host, OutPacket& to_host) {
 			case HOST_CMD_EXTENDED_STOP:
 				handleExtendedStop(from_host,to_host);
 				return true;
+			case HOST_CMD_GET_TOOL_LINK_STATS:
+				handleGetToolLinkStats(from_host,to_host);
+				return true;
+			case HOST_CMD_SET_BAUD_RATE:
+				handleSetBaudRate(from_host,to_host);
+				return true;
 			}
 		}
 	}
@@ -26,12 +26,14 @@
 #include "Motherboard.hh"
 #include "SDCard.hh"
 #include "EepromMap.hh"
+#include "Checkpoint.hh"
 
 void reset(bool hard_reset) {
 	ATOMIC_BLOCK(ATOMIC_FORCEON) {
 		Motherboard& board = Motherboard::getBoard();
 		sdcard::reset();
 		steppers::abort();
+		steppers::setSpeedOverride(100);
 		command::reset();
 		eeprom::init();
 		board.reset();
@@ -62,6 +64,10 @@ int main() {
 		runHostSlice();
 		// Command handling thread.
 		command::runCommandSlice();
+		// SD card detection.
+		sdcard::runSdSlice();
+		// Build checkpoint writes.
+		checkpoint::runCheckpointSlice();
 	}
 	return 0;
 }
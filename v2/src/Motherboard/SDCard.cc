@@ -19,6 +19,13 @@
 
 #include <avr/io.h>
 #include <string.h>
+#include <util/crc16.h>
+#include "Commands.hh"
+#include "BuildCodec.hh"
+#include "Steppers.hh"
+#include "Timeout.hh"
+#include "Errors.hh"
+#include "Motherboard.hh"
 #include "lib_sd/sd-reader_config.h"
 #include "lib_sd/fat.h"
 #include "lib_sd/sd_raw.h"
@@ -80,35 +87,139 @@ bool openRoot()
   return dd != 0;
 }
 
+/// The directory index holds a hash of each name in the root directory and
+/// the position of its entry, so that finding a file doesn't mean reading
+/// and comparing every entry before it.  If the directory has more entries
+/// than fit, only the first ones are indexed, and lookups that miss the
+/// index go on to scan the rest of the directory.
+#define DIR_INDEX_SIZE 48
+
+struct DirIndexEntry {
+	uint16_t hash;
+	struct fat_dir_pos_struct pos;
+};
+
+DirIndexEntry dir_index[DIR_INDEX_SIZE];
+uint8_t dir_index_count = 0;
+/// False if the directory has changed since the index was built
+bool dir_index_valid = false;
+/// True if the directory had more entries than the index holds
+bool dir_index_partial = false;
+/// Directory position following the last indexed entry
+struct fat_dir_pos_struct dir_index_end;
+
+/// Release the card's filesystem handles.
+void unmountCard() {
+	dir_index_valid = false;
+	if (dd != 0) {
+		fat_close_dir(dd);
+		dd = 0;
+	}
+	if (fs != 0) {
+		fat_close(fs);
+		fs = 0;
+	}
+	if (partition != 0) {
+		partition_close(partition);
+		partition = 0;
+	}
+}
+
 SdErrorCode initCard() {
 	if (!sd_raw_init()) {
 		if (!sd_raw_available()) {
-			reset();
+			unmountCard();
 			return SD_ERR_NO_CARD_PRESENT;
 		} else {
-			reset();
+			unmountCard();
 			return SD_ERR_INIT_FAILED;
 		}
 	} else if (!openPartition()) {
-		reset();
+		unmountCard();
 		return SD_ERR_PARTITION_READ;
 	} else if (!openFilesys()) {
-		reset();
+		unmountCard();
 		return SD_ERR_OPEN_FILESYSTEM;
 	} else if (!openRoot()) {
-		reset();
+		unmountCard();
 		return SD_ERR_NO_ROOT;
-		
+	}
+	return SD_SUCCESS;
+}
+
+uint16_t hashName(const char* name) {
+	uint16_t hash = 0;
+	while (*name != '\0') {
+		hash = (hash * 31) + (uint8_t)*name++;
+	}
+	return hash;
+}
+
+void buildDirIndex() {
+	struct fat_dir_entry_struct entry;
+	struct fat_dir_pos_struct pos;
+	dir_index_count = 0;
+	dir_index_partial = false;
+	fat_reset_dir(dd);
+	while (true) {
+		fat_get_dir_pos(dd, &pos);
+		if (!fat_read_dir(dd, &entry)) {
+			break;
+		}
+		if (dir_index_count == DIR_INDEX_SIZE) {
+			dir_index_partial = true;
+			dir_index_end = pos;
+			break;
+		}
+		dir_index[dir_index_count].hash = hashName(entry.long_name);
+		dir_index[dir_index_count].pos = pos;
+		dir_index_count++;
+	}
+	fat_reset_dir(dd);
+	dir_index_valid = true;
+}
+
+/// Last seen state of the card detect switch
+bool card_present = false;
+
+/// Mount the card, unless it is still mounted from an earlier operation.
+/// The card stays mounted until it is removed; only files are opened and
+/// closed per operation.
+SdErrorCode mountCard() {
+	if (dd == 0) {
+		SdErrorCode rsp = initCard();
+		if (rsp != SD_SUCCESS) {
+			return rsp;
+		}
+		card_present = true;
+		buildDirIndex();
+	}
 	/* we need to keep locked as the last check */
-	} else if (sd_raw_locked()) {
+	if (sd_raw_locked()) {
 		return SD_ERR_CARD_LOCKED;
 	}
 	return SD_SUCCESS;
 }
 
+void flushPendingCapture();
+void writePendingIndex();
+
+void runSdSlice() {
+	flushPendingCapture();
+	writePendingIndex();
+	const bool present = sd_raw_available();
+	if (present != card_present) {
+		// The card was pulled or swapped; anything we know about the
+		// filesystem is stale.  The next operation will mount it afresh.
+		card_present = present;
+		reset();
+		unmountCard();
+	}
+}
+
 SdErrorCode directoryReset() {
   reset();
-  SdErrorCode rsp = initCard();
+  SdErrorCode rsp = mountCard();
   if (rsp != SD_SUCCESS && rsp != SD_ERR_CARD_LOCKED) {
     return rsp;
   }
@@ -116,8 +227,12 @@ SdErrorCode directoryReset() {
   return SD_SUCCESS;
 }
 
+/// Directory position before the last directoryNextEntry() call
+struct fat_dir_pos_struct last_entry_pos;
+
 SdErrorCode directoryNextEntry(char* buffer, uint8_t bufsize) {
 	struct fat_dir_entry_struct entry;
+	fat_get_dir_pos(dd, &last_entry_pos);
 	// This is a bit of a hack.  For whatever reason, some filesystems return
 	// files with nulls as the first character of their name.  This isn't
 	// necessarily broken in of itself, but a null name is also our way
@@ -145,17 +260,33 @@ SdErrorCode directoryNextEntry(char* buffer, uint8_t bufsize) {
 	return SD_SUCCESS;
 }
 
+void directoryUnreadEntry() {
+	fat_set_dir_pos(dd, &last_entry_pos);
+}
+
 bool findFileInDir(const char* name, struct fat_dir_entry_struct* dir_entry)
 {
-  while(fat_read_dir(dd, dir_entry))
-  {
-    if(strcmp(dir_entry->long_name, name) == 0)
-    {
-      fat_reset_dir(dd);
-      return true;
+  if (!dir_index_valid) {
+    buildDirIndex();
+  }
+  const uint16_t hash = hashName(name);
+  bool found = false;
+  for (uint8_t i = 0; i < dir_index_count && !found; i++) {
+    if (dir_index[i].hash == hash) {
+      // Hashes can collide, so check the name itself.
+      fat_set_dir_pos(dd, &dir_index[i].pos);
+      found = fat_read_dir(dd, dir_entry) &&
+          strcmp(dir_entry->long_name, name) == 0;
     }
   }
-  return false;
+  if (!found && dir_index_partial) {
+    fat_set_dir_pos(dd, &dir_index_end);
+    while (!found && fat_read_dir(dd, dir_entry)) {
+      found = strcmp(dir_entry->long_name, name) == 0;
+    }
+  }
+  fat_reset_dir(dd);
+  return found;
 }
 
 bool openFile(const char* name, struct fat_file_struct** file)
@@ -178,12 +309,14 @@ bool deleteFile(char *name)
     return false;
   }
   fat_delete_file(fs, &fileEntry);
+  dir_index_valid = false;
   return true;
 }
 
 bool createFile(char *name)
 {
   struct fat_dir_entry_struct fileEntry;
+  dir_index_valid = false;
   return fat_create_file(dd, name, &fileEntry) != 0;
 }
 
@@ -191,6 +324,91 @@ bool capturing = false;
 bool playing = false;
 uint32_t capturedBytes = 0L;
 
+/// Playback reads and capture writes go through this buffer a whole sector
+/// at a time, rather than through the FAT library for every byte or packet.
+/// Only one of them is active at once.  Keep it a multiple of the sector
+/// size so that file accesses stay sector aligned.
+#define FILE_BUFFER_SIZE 512
+
+#if FILE_BUFFER_SIZE != BUILD_BLOCK_SIZE
+#error The file buffer must hold exactly one build file block.
+#endif
+
+uint8_t file_buffer[FILE_BUFFER_SIZE];
+
+/// Header of the build file being captured or played back.  For a file
+/// without a header, everything but the byte count is zero.
+BuildHeader build_header;
+
+/// The capture file is grown in steps of this size, so that cluster
+/// allocation isn't done piecemeal as the data arrives.  The excess is
+/// trimmed off in finishCapture().
+#define CAPTURE_PREALLOCATE_BYTES (64L*1024L)
+
+/// Initial least number of commands between index entries.  Each time the
+/// index fills up, every other entry is dropped and the spacing doubles.
+#define CAPTURE_INDEX_SPACING 128
+
+/// Number of bytes allocated to the capture file
+uint32_t capture_allocated = 0;
+/// Number of bytes written to the capture file
+uint32_t capture_file_bytes = 0;
+/// Machine position at the end of the captured commands
+int32_t capture_position[BUILD_AXIS_COUNT];
+/// Estimated build time not yet counted in the header's duration
+uint32_t capture_micros = 0;
+/// Packs the captured commands into the file buffer a block at a time
+BuildBlockPacker packer(file_buffer);
+/// Number of the command at the last index entry
+uint32_t capture_last_index = 0;
+/// Number of index entries, counting those still queued
+uint8_t capture_index_entries = 0;
+
+/// Index entries wait here for runSdSlice() to write them, so that
+/// capturePacket() doesn't touch the index in the header block.  An entry
+/// that finds the queue full is skipped; the index is only a shortcut.
+#define CAPTURE_INDEX_QUEUE 2
+BuildIndexEntry index_queue[CAPTURE_INDEX_QUEUE];
+uint8_t index_queued = 0;
+/// Next entry to move down while halving the index, or 0 if not halving
+uint8_t index_halving = 0;
+
+/// True if captured commands are also being run
+bool teeing = false;
+/// In tee mode, a full block isn't written by capturePacket(), which would
+/// hold up the host and command threads.  It waits in the buffer for
+/// runSdSlice() to write it while a move is running, which the write
+/// doesn't delay.  If no move comes along, it is written after a while
+/// anyway.
+bool capture_flush_pending = false;
+Timeout capture_flush_timeout;
+#define CAPTURE_FLUSH_WAIT_MICROS (100L*1000L)
+
+/// Uses the CRC the build file format specifies.
+uint16_t blockCrc(const uint8_t* data, uint16_t length) {
+	uint16_t crc = 0;
+	for (uint16_t i = 0; i < length; i++) {
+		crc = _crc16_update(crc, data[i]);
+	}
+	return crc;
+}
+
+/// Read from the given offset of the open file.  Leaves the file
+/// positioned after the data read.
+void readAt(int32_t offset, void* data, uint16_t length) {
+	fat_seek_file(file, &offset, FAT_SEEK_SET);
+	fat_read_file(file, (uint8_t*)data, length);
+}
+
+/// Write to the given offset of the capture file, and go back to the end
+/// of the data captured so far.
+void writeAt(int32_t offset, const void* data, uint16_t length) {
+	fat_seek_file(file, &offset, FAT_SEEK_SET);
+	fat_write_file(file, (const uint8_t*)data, length);
+	offset = capture_file_bytes;
+	fat_seek_file(file, &offset, FAT_SEEK_SET);
+}
+
 bool isPlaying() {
 	return playing;
 }
@@ -199,10 +417,14 @@ bool isCapturing() {
 	return capturing;
 }
 
-SdErrorCode startCapture(char* filename)
+inline int32_t indexEntryOffset(uint8_t index) {
+	return BUILD_INDEX_OFFSET + (int32_t)index * sizeof(BuildIndexEntry);
+}
+
+SdErrorCode startCapture(char* filename, bool tee)
 {
   reset();
-  SdErrorCode result = initCard();
+  SdErrorCode result = mountCard();
   if (result != SD_SUCCESS) {
     return result;
   }
@@ -221,17 +443,204 @@ SdErrorCode startCapture(char* filename)
     return SD_ERR_GENERIC;
   }
 
+  // Write the header block now, so that the commands start on a block
+  // boundary.  The totals are filled in when the capture is finished.
+  memset(&build_header, 0, sizeof(build_header));
+  build_header.magic = BUILD_FILE_MAGIC;
+  build_header.version = BUILD_FILE_VERSION;
+  build_header.index_spacing = CAPTURE_INDEX_SPACING;
+  build_header.byte_count = BUILD_LENGTH_UNKNOWN;
+  build_header.encoding = BUILD_ENCODING_PACKED;
+  memset(file_buffer, 0, BUILD_BLOCK_SIZE);
+  memcpy(file_buffer, &build_header, sizeof(build_header));
+  fat_write_file(file, file_buffer, BUILD_BLOCK_SIZE);
+
+  memset(capture_position, 0, sizeof(capture_position));
+  capture_micros = 0;
+  capture_last_index = 0;
+  capture_index_entries = 0;
+  index_queued = 0;
+  index_halving = 0;
+  packer.reset(tee);
+  capture_allocated = 0;
+  capture_file_bytes = BUILD_BLOCK_SIZE;
+  capture_flush_pending = false;
+  teeing = tee;
   capturing = true;
   return SD_SUCCESS;
 }
 
+/// Write out the contents of the capture buffer as a block of the build
+/// file.
+void flushCaptureBuffer()
+{
+  uint16_t length = packer.getLength();
+  if (length == 0) return;
+  const uint16_t crc = blockCrc(file_buffer, length);
+  file_buffer[length++] = crc & 0xff;
+  file_buffer[length++] = crc >> 8;
+  if (capture_file_bytes + length > capture_allocated) {
+    // If preallocation fails (say, the card is nearly full) the write
+    // below will still grow the file as far as it can.
+    if (fat_resize_file(file, capture_allocated + CAPTURE_PREALLOCATE_BYTES)) {
+      capture_allocated += CAPTURE_PREALLOCATE_BYTES;
+    }
+  }
+  fat_write_file(file, file_buffer, length);
+  capture_file_bytes += length;
+  packer.clear();
+  capture_flush_pending = false;
+}
+
+void flushPendingCapture() {
+  if (capture_flush_pending && (steppers::isRunning() ||
+      capture_flush_timeout.hasElapsed())) {
+    flushCaptureBuffer();
+  }
+}
+
+/// Record that playback can start from the command about to be captured.
+/// The entry is queued for writeIndexStep().
+void addIndexEntry() {
+	if (index_queued == CAPTURE_INDEX_QUEUE) {
+		return;
+	}
+	if (capture_index_entries == BUILD_INDEX_SIZE) {
+		// Out of room; every other entry will be dropped.
+		capture_index_entries = BUILD_INDEX_SIZE/2;
+		build_header.index_spacing *= 2;
+	}
+	capture_index_entries++;
+	BuildIndexEntry& entry = index_queue[index_queued++];
+	entry.offset = capturedBytes;
+	entry.command = build_header.command_count;
+	memcpy(entry.position, capture_position, sizeof(capture_position));
+	capture_last_index = build_header.command_count;
+}
+
+/// Write the next queued index entry to the file.  When the index is full,
+/// every other entry is dropped first, moving one entry down per call.
+void writeIndexStep() {
+	BuildIndexEntry entry;
+	if (index_halving != 0) {
+		readAt(indexEntryOffset(index_halving*2), &entry, sizeof(entry));
+		writeAt(indexEntryOffset(index_halving), &entry, sizeof(entry));
+		if (++index_halving == BUILD_INDEX_SIZE/2) {
+			build_header.index_count = BUILD_INDEX_SIZE/2;
+			index_halving = 0;
+		}
+		return;
+	}
+	if (index_queued == 0) {
+		return;
+	}
+	if (build_header.index_count == BUILD_INDEX_SIZE) {
+		index_halving = 1;
+		return;
+	}
+	writeAt(indexEntryOffset(build_header.index_count), &index_queue[0],
+			sizeof(entry));
+	build_header.index_count++;
+	index_queued--;
+	memmove(index_queue, index_queue + 1, index_queued * sizeof(entry));
+}
+
+/// In tee mode, index entries are written while a move runs, like full
+/// blocks.
+void writePendingIndex() {
+	if (!capturing || file == 0 || capture_flush_pending) {
+		return;
+	}
+	if (teeing && !steppers::isRunning()) {
+		return;
+	}
+	writeIndexStep();
+}
+
+/// Follow the machine position and elapsed time through the captured
+/// commands, for the header and the seek index.
+void trackCommand(const Packet& packet) {
+	const uint8_t command = packet.read8(0);
+	const uint8_t length = packet.getLength();
+	uint8_t axes = 0;
+	uint8_t relative = 0;
+	bool define = false;
+	uint32_t us_per_step = 0;
+	uint32_t micros = 0;
+	if (command == HOST_CMD_QUEUE_POINT_ABS && length >= 17) {
+		axes = 3;
+		us_per_step = packet.read32(13);
+	} else if (command == HOST_CMD_QUEUE_POINT_EXT && length >= 25) {
+		axes = 5;
+		us_per_step = packet.read32(21);
+	} else if (command == HOST_CMD_QUEUE_POINT_NEW && length >= 26) {
+		axes = 5;
+		micros = packet.read32(21);
+		relative = packet.read8(25);
+	} else if (command == HOST_CMD_SET_POSITION && length >= 13) {
+		axes = 3;
+		define = true;
+	} else if (command == HOST_CMD_SET_POSITION_EXT && length >= 21) {
+		axes = 5;
+		define = true;
+	} else if (command == HOST_CMD_DELAY && length >= 5) {
+		micros = packet.read32(1) * 1000;
+	}
+	if (axes != 0) {
+		int32_t target[BUILD_AXIS_COUNT];
+		uint32_t max_delta = 0;
+		for (uint8_t i = 0; i < BUILD_AXIS_COUNT; i++) {
+			// Commands with three axes zero the others, as in the
+			// command queue.
+			target[i] = (i < axes) ? (int32_t)packet.read32(1 + i*4) : 0;
+			if ((relative & (1 << i)) != 0) {
+				target[i] += capture_position[i];
+			}
+			int32_t delta = target[i] - capture_position[i];
+			if (delta < 0) { delta = -delta; }
+			if ((uint32_t)delta > max_delta) { max_delta = delta; }
+		}
+		if (!define) {
+			micros += us_per_step * max_delta;
+			// A new layer starts whenever Z moves.
+			if (target[2] != capture_position[2] &&
+					build_header.command_count - capture_last_index >=
+					build_header.index_spacing) {
+				addIndexEntry();
+			}
+		}
+		memcpy(capture_position, target, sizeof(target));
+	}
+	capture_micros += micros;
+	build_header.duration += capture_micros / 1000000L;
+	capture_micros %= 1000000L;
+	build_header.command_count++;
+}
+
 void capturePacket(const Packet& packet)
 {
 	if (file == 0) return;
-	// Casting away volatile is OK in this instance; we know where the
-	// data is located and that fat_write_file isn't caching
-	fat_write_file(file, (uint8_t*)packet.getData(), packet.getLength());
+	trackCommand(packet);
+	if (!packer.add(packet, capturedBytes)) {
+		// The block is full; write it out and start the next one.
+		flushCaptureBuffer();
+		packer.add(packet, capturedBytes);
+	}
 	capturedBytes += packet.getLength();
+	if (teeing && packer.isClosed()) {
+		// In tee mode the block is closed while the next token is sure to
+		// need a new one.  Leave it for runSdSlice() to write.
+		capture_flush_pending = true;
+		capture_flush_timeout.start(CAPTURE_FLUSH_WAIT_MICROS);
+	}
+}
+
+bool captureHasRoom() {
+	return !capture_flush_pending;
+}
+
+bool isTeeing() {
+	return capturing && teeing;
 }
 
 
@@ -239,6 +648,16 @@ uint32_t finishCapture()
 {
   if (capturing) {
     if (file != 0) {
+    	flushCaptureBuffer();
+    	while (index_queued != 0 || index_halving != 0) {
+    		writeIndexStep();
+    	}
+    	// Trim the preallocated space we didn't use.
+    	if (capture_allocated > capture_file_bytes) {
+    		fat_resize_file(file, capture_file_bytes);
+    	}
+    	build_header.byte_count = capturedBytes;
+    	writeAt(0, &build_header, sizeof(build_header));
     	fat_close_file(file);
     	sd_raw_sync();
     }
@@ -249,48 +668,320 @@ uint32_t finishCapture()
   return capturedBytes;
 }
 
-uint8_t next_byte;
-bool has_more;
+/// Number of valid bytes in the playback buffer
+uint16_t playback_length = 0;
+/// Index of the next byte to return from the playback buffer
+uint16_t playback_index = 0;
+/// Offset in the command stream of the first byte in the playback buffer
+uint32_t playback_offset = 0;
+/// File offset of the command stream
+uint16_t playback_data_start = 0;
+/// Number of command bytes in each block of the playback file
+uint16_t playback_block_data = FILE_BUFFER_SIZE;
+/// Size of the playback file
+uint32_t playback_file_size = 0;
+/// Where the bytes to play back are.  For a packed build file, this is the
+/// last command decoded; otherwise it's the file buffer.
+uint8_t* playback_data = file_buffer;
+
+/// State of the decoder for packed build files
+BuildDecoder decoder;
+uint8_t decoded_command[BUILD_MAX_COMMAND];
+/// Length of the block in the file buffer, and the offset of the next
+/// token in it
+uint16_t block_length = 0;
+uint16_t block_index = 0;
+/// Set when a bad block stops the playback
+SdErrorCode playback_error = SD_SUCCESS;
+
+/// Stop the playback at a bad block.  Skip to the end of the file, so
+/// that nothing after the bad block is played either, and flag the error.
+void abortPlayback() {
+  int32_t end = 0;
+  fat_seek_file(file, &end, FAT_SEEK_END);
+  playback_error = SD_ERR_BAD_BLOCK;
+  Motherboard::getBoard().indicateError(ERR_SD_BAD_BLOCK);
+}
+
+/// Read the next block of the file into the file buffer, and return the
+/// length of its data.  A block that fails its CRC ends the playback.
+uint16_t readPlaybackBlock() {
+  if (file == 0) {
+    // A finished playlist leaves no file open.
+    return 0;
+  }
+  int16_t read = fat_read_file(file, file_buffer, FILE_BUFFER_SIZE);
+  if (read > 0 && playback_data_start != 0) {
+    read -= 2;
+    if (read <= 0 || blockCrc(file_buffer, read) !=
+        (file_buffer[read] | (file_buffer[read+1] << 8))) {
+      abortPlayback();
+      read = 0;
+    }
+  }
+  return (read > 0) ? read : 0;
+}
+
+/// Load the next run of bytes to play back.  For a packed build file,
+/// that is the next command, read from the file a block at a time.
+void fillPlaybackBuffer() {
+  playback_offset += playback_length;
+  playback_index = 0;
+  if (playback_data == file_buffer) {
+    playback_length = readPlaybackBlock();
+    return;
+  }
+  playback_length = 0;
+  while (playback_length == 0) {
+    if (block_index >= block_length) {
+      block_length = readPlaybackBlock();
+      if (block_length <= sizeof(uint32_t)) {
+        block_length = 0;
+        return;
+      }
+      // Each block starts with the offset of its first command.
+      memcpy(&playback_offset, file_buffer, sizeof(uint32_t));
+      block_index = sizeof(uint32_t);
+      decoder.reset();
+    }
+    uint8_t length;
+    const uint8_t used = decoder.decode(file_buffer + block_index,
+        block_length - block_index, decoded_command, length);
+    if (used == 0) {
+      // Bad token; treat it like a bad block.
+      abortPlayback();
+      block_length = 0;
+      return;
+    }
+    block_index += used;
+    if (length == 0) {
+      // An empty command pads out the rest of the block.
+      block_index = block_length;
+    }
+    playback_length = length;
+  }
+}
 
-void fetchNextByte() {
-  int16_t read = fat_read_file(file, &next_byte, 1);
-  has_more = read > 0;
+/// Move playback to the given offset in the command stream.
+void seekPlayback(uint32_t target) {
+  uint32_t block = target / playback_block_data;
+  if (playback_data != file_buffer) {
+    // Packed blocks hold varying numbers of commands.  Search for the
+    // last one that starts at or before the target.
+    uint32_t end = (playback_file_size - playback_data_start +
+        FILE_BUFFER_SIZE - 1) / FILE_BUFFER_SIZE;
+    block = 0;
+    while (end - block > 1) {
+      const uint32_t middle = (block + end) / 2;
+      uint32_t start;
+      readAt(playback_data_start + middle * FILE_BUFFER_SIZE, &start,
+          sizeof(start));
+      if (start <= target) {
+        block = middle;
+      } else {
+        end = middle;
+      }
+    }
+  }
+  int32_t block_start = playback_data_start + block * FILE_BUFFER_SIZE;
+  playback_offset = block * playback_block_data;
+  playback_length = 0;
+  block_length = 0;
+  block_index = 0;
+  fat_seek_file(file, &block_start, FAT_SEEK_SET);
+  fillPlaybackBuffer();
+  while (playback_length > 0 &&
+      target >= playback_offset + playback_length) {
+    fillPlaybackBuffer();
+  }
+  playback_index = target - playback_offset;
 }
 
+bool playNextInPlaylist();
+
 bool playbackHasNext() {
-  return has_more;
+  if (playback_index >= playback_length) {
+    // Refill as soon as the buffer runs dry, so the next byte is ready
+    // before it's asked for.
+    fillPlaybackBuffer();
+    // At the end of a file, go on to the next one in the playlist.
+    // Starting a file fills the buffer from it.  A bad block stops the
+    // playlist too.
+    while (playback_index >= playback_length &&
+        playback_error == SD_SUCCESS && playNextInPlaylist()) {
+    }
+  }
+  return playback_index < playback_length;
 }
 
 uint8_t playbackNext() {
-  uint8_t rv = next_byte;
-  fetchNextByte();
-  return rv;
+  if (!playbackHasNext()) {
+    return 0;
+  }
+  return playback_data[playback_index++];
 }
 
-SdErrorCode startPlayback(char* filename) {
+/// Close a file opened by openBuildFile() without playing it.
+void closeBuildFile() {
+  fat_close_file(file);
+  file = 0;
+}
+
+/// Open a build file and read its header.  Leaves the file position
+/// undefined.
+SdErrorCode openBuildFile(char* filename) {
   reset();
-  SdErrorCode result = initCard();
+  SdErrorCode result = mountCard();
   /* for playback it's ok if the card is locked */
   if (result != SD_SUCCESS && result != SD_ERR_CARD_LOCKED) {
     return result;
   }
   capturedBytes = 0L;
   file = 0;
+  playback_error = SD_SUCCESS;
   if (!openFile(filename, &file) || file == 0) {
     return SD_ERR_FILE_NOT_FOUND;
   }
+  const bool has_header =
+      fat_read_file(file, file_buffer, BUILD_BLOCK_SIZE) == BUILD_BLOCK_SIZE &&
+      ((BuildHeader*)file_buffer)->magic == BUILD_FILE_MAGIC &&
+      ((BuildHeader*)file_buffer)->version == BUILD_FILE_VERSION;
+  memcpy(&build_header, file_buffer, sizeof(build_header));
+  int32_t size = 0;
+  fat_seek_file(file, &size, FAT_SEEK_END);
+  playback_file_size = size;
+  playback_data = file_buffer;
+  if (has_header) {
+    playback_data_start = BUILD_BLOCK_SIZE;
+    playback_block_data = BUILD_BLOCK_DATA;
+    if (build_header.encoding == BUILD_ENCODING_PACKED) {
+      playback_data = decoded_command;
+    } else if (build_header.encoding != BUILD_ENCODING_PLAIN) {
+      closeBuildFile();
+      return SD_ERR_UNKNOWN_FORMAT;
+    }
+  } else {
+    // No header; play the whole file as it is.
+    memset(&build_header, 0, sizeof(build_header));
+    build_header.byte_count = size;
+    playback_data_start = 0;
+    playback_block_data = FILE_BUFFER_SIZE;
+  }
+  return SD_SUCCESS;
+}
+
+/// Read an entry of the open file's seek index.
+SdErrorCode readIndexEntry(uint8_t index, BuildIndexEntry& entry) {
+  if (index >= build_header.index_count) {
+    return SD_ERR_NO_INDEX_ENTRY;
+  }
+  readAt(indexEntryOffset(index), &entry, sizeof(entry));
+  return SD_SUCCESS;
+}
+
+SdErrorCode getBuildInfo(char* filename, BuildHeader& header) {
+  memset(&header, 0, sizeof(header));
+  if (playing || capturing) {
+    return SD_ERR_BUSY;
+  }
+  SdErrorCode result = openBuildFile(filename);
+  if (result == SD_SUCCESS) {
+    header = build_header;
+    closeBuildFile();
+  }
+  return result;
+}
+
+SdErrorCode getBuildIndexEntry(char* filename, uint8_t index,
+    BuildIndexEntry& entry) {
+  memset(&entry, 0, sizeof(entry));
+  if (playing || capturing) {
+    return SD_ERR_BUSY;
+  }
+  SdErrorCode result = openBuildFile(filename);
+  if (result == SD_SUCCESS) {
+    result = readIndexEntry(index, entry);
+    closeBuildFile();
+  }
+  return result;
+}
+
+SdErrorCode startPlaybackFrom(char* filename, uint32_t offset) {
+  SdErrorCode result = openBuildFile(filename);
+  if (result != SD_SUCCESS) {
+    return result;
+  }
+  playing = true;
+  seekPlayback(offset);
+  return SD_SUCCESS;
+}
+
+SdErrorCode startPlayback(char* filename) {
+  return startPlaybackFrom(filename, 0);
+}
+
+SdErrorCode startPlaybackAt(char* filename, uint8_t index,
+    BuildIndexEntry& entry) {
+  memset(&entry, 0, sizeof(entry));
+  SdErrorCode result = openBuildFile(filename);
+  if (result != SD_SUCCESS) {
+    return result;
+  }
+  result = readIndexEntry(index, entry);
+  if (result != SD_SUCCESS) {
+    closeBuildFile();
+    return result;
+  }
   playing = true;
-  fetchNextByte();
+  seekPlayback(entry.offset);
   return SD_SUCCESS;
 }
 
+void playbackFill(CircularBuffer& buf) {
+  BufSizeType capacity = buf.getRemainingCapacity();
+  while (capacity > 0 && playbackHasNext()) {
+    BufSizeType run = playback_length - playback_index;
+    if (run > capacity) { run = capacity; }
+    buf.push(playback_data + playback_index, run);
+    playback_index += run;
+    capacity -= run;
+  }
+}
+
+uint32_t playbackPosition() {
+  return playback_offset + playback_index;
+}
+
+uint32_t playbackFileSize() {
+  return playing ? playback_file_size : 0;
+}
+
+uint32_t playbackLength() {
+  return playing ? build_header.byte_count : 0;
+}
+
+SdErrorCode playbackError() {
+  return playback_error;
+}
+
 void playbackRewind(uint8_t bytes) {
-  int32_t offset = -((int32_t)bytes);
-  fat_seek_file(file, &offset, FAT_SEEK_CUR);
+  if (bytes <= playback_index) {
+    playback_index -= bytes;
+    return;
+  }
+  // Rewinding past the start of the buffer; reload the block containing
+  // the target.
+  uint32_t target = playback_offset + playback_index;
+  seekPlayback((target > bytes) ? target - bytes : 0);
 }
 
-void finishPlayback() {
+/// Close the file being played back.
+void closePlaybackFile() {
   playing = false;
+  playback_length = 0;
+  playback_index = 0;
+  // Release the card from any multi-block read the playback left open.
+  sd_raw_stop_stream();
   if (file != 0) {
 	  fat_close_file(file);
 	  sd_raw_sync();
@@ -298,24 +989,214 @@ void finishPlayback() {
   file = 0;
 }
 
+/// A playlist is a text file listing builds to play one after another.
+/// Each line names a build file, optionally followed by the number of
+/// times to play it and the names of files to play before and after each
+/// run of it, separated by spaces:
+///
+///   BUILD.S3G 3 START.S3G END.S3G
+///
+/// A start or end file of "-" is skipped.  Blank lines and lines starting
+/// with '#' are ignored.  Only one file can be open at a time, so the
+/// playlist is only opened to read the entry it has reached.
+#define PLAYLIST_NAME_SIZE 32
+/// Longest line a playlist can hold
+#define PLAYLIST_LINE_SIZE 128
+
+enum {
+  PLAYLIST_NEXT_ENTRY,
+  PLAYLIST_START,
+  PLAYLIST_BUILD,
+  PLAYLIST_END
+};
+
+bool playlist_active = false;
+char playlist_name[PLAYLIST_NAME_SIZE];
+/// Offset in the playlist of the current entry
+uint32_t playlist_line = 0;
+/// Runs of the current entry left to start
+uint16_t playlist_repeats = 0;
+/// What to play next for the current entry
+uint8_t playlist_step = PLAYLIST_NEXT_ENTRY;
+
+struct PlaylistEntry {
+  char* build;
+  uint16_t repeats;
+  char* start;
+  char* end;
+  /// Length of the line, including its end
+  uint8_t length;
+};
+
+/// Split off the next field of a playlist line, or return 0 if there are
+/// no more.
+char* nextField(char*& p) {
+  while (*p == ' ' || *p == '\t') {
+    p++;
+  }
+  if (*p == '\0') {
+    return 0;
+  }
+  char* field = p;
+  while (*p != '\0' && *p != ' ' && *p != '\t') {
+    p++;
+  }
+  if (*p != '\0') {
+    *p++ = '\0';
+  }
+  return field;
+}
+
+/// Read the playlist entry at playlist_line into the file buffer, skipping
+/// comments and blank lines.  Returns false at the end of the playlist, or
+/// if it can't be read.
+bool readPlaylistEntry(PlaylistEntry& entry) {
+  if (mountCard() != SD_SUCCESS) {
+    return false;
+  }
+  struct fat_file_struct* list = 0;
+  if (!openFile(playlist_name, &list) || list == 0) {
+    return false;
+  }
+  char* line = (char*)file_buffer;
+  bool found = false;
+  while (!found) {
+    int32_t offset = playlist_line;
+    fat_seek_file(list, &offset, FAT_SEEK_SET);
+    const int16_t read = fat_read_file(list, file_buffer,
+        PLAYLIST_LINE_SIZE - 1);
+    if (read <= 0) {
+      break;
+    }
+    uint8_t length = 0;
+    while (length < read && line[length] != '\n') {
+      length++;
+    }
+    if (length == read && read == PLAYLIST_LINE_SIZE - 1) {
+      // Too long to be a line.
+      break;
+    }
+    line[length] = '\0';
+    if (length > 0 && line[length-1] == '\r') {
+      line[length-1] = '\0';
+    }
+    entry.length = (length < read) ? length + 1 : length;
+    char* p = line;
+    entry.build = nextField(p);
+    if (entry.build == 0 || entry.build[0] == '#') {
+      playlist_line += entry.length;
+      continue;
+    }
+    char* repeats = nextField(p);
+    entry.repeats = 0;
+    if (repeats != 0) {
+      while (*repeats >= '0' && *repeats <= '9') {
+        entry.repeats = entry.repeats * 10 + (*repeats++ - '0');
+      }
+    }
+    if (entry.repeats == 0) {
+      entry.repeats = 1;
+    }
+    entry.start = nextField(p);
+    entry.end = nextField(p);
+    found = true;
+  }
+  fat_close_file(list);
+  return found;
+}
+
+/// Open the next file of the playlist and start playing it.  Returns false
+/// if the playlist has run out, or isn't being played.
+bool playNextInPlaylist() {
+  while (playlist_active) {
+    PlaylistEntry entry;
+    closePlaybackFile();
+    if (!readPlaylistEntry(entry)) {
+      break;
+    }
+    char* next = 0;
+    switch (playlist_step) {
+    case PLAYLIST_NEXT_ENTRY:
+      playlist_repeats = entry.repeats;
+      playlist_step = PLAYLIST_START;
+      break;
+    case PLAYLIST_START:
+      next = entry.start;
+      playlist_step = PLAYLIST_BUILD;
+      break;
+    case PLAYLIST_BUILD:
+      next = entry.build;
+      playlist_step = PLAYLIST_END;
+      break;
+    case PLAYLIST_END:
+      next = entry.end;
+      if (--playlist_repeats > 0) {
+        playlist_step = PLAYLIST_START;
+      } else {
+        playlist_step = PLAYLIST_NEXT_ENTRY;
+        playlist_line += entry.length;
+      }
+      break;
+    }
+    if (next == 0 || strcmp(next, "-") == 0) {
+      continue;
+    }
+    // Opening the file reuses the buffer the name is in.
+    char name[PLAYLIST_NAME_SIZE];
+    strncpy(name, next, PLAYLIST_NAME_SIZE - 1);
+    name[PLAYLIST_NAME_SIZE - 1] = '\0';
+    if (openBuildFile(name) != SD_SUCCESS) {
+      break;
+    }
+    playing = true;
+    seekPlayback(0);
+    return true;
+  }
+  playlist_active = false;
+  return false;
+}
+
+SdErrorCode startPlaylist(char* filename) {
+  reset();
+  SdErrorCode result = mountCard();
+  if (result != SD_SUCCESS && result != SD_ERR_CARD_LOCKED) {
+    return result;
+  }
+  struct fat_file_struct* list = 0;
+  if (!openFile(filename, &list) || list == 0) {
+    return SD_ERR_FILE_NOT_FOUND;
+  }
+  fat_close_file(list);
+  strncpy(playlist_name, filename, PLAYLIST_NAME_SIZE - 1);
+  playlist_name[PLAYLIST_NAME_SIZE - 1] = '\0';
+  playlist_line = 0;
+  playlist_step = PLAYLIST_NEXT_ENTRY;
+  PlaylistEntry entry;
+  if (!readPlaylistEntry(entry)) {
+    return SD_ERR_BAD_PLAYLIST;
+  }
+  playlist_active = true;
+  if (!playNextInPlaylist()) {
+    return SD_ERR_FILE_NOT_FOUND;
+  }
+  return SD_SUCCESS;
+}
+
+bool isPlayingPlaylist() {
+  return playlist_active;
+}
+
+void finishPlayback() {
+  playlist_active = false;
+  closePlaybackFile();
+}
+
 
 void reset() {
 	if (playing)
 		finishPlayback();
 	if (capturing)
 		finishCapture();
-	if (dd != 0) {
-		fat_close_dir(dd);
-		dd = 0;
-	}
-	if (fs != 0) {
-		fat_close(fs);
-		fs = 0;
-	}
-	if (partition != 0) {
-		partition_close(partition);
-		partition = 0;
-	}
 }
 
 } // namespace sdcard
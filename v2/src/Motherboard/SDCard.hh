@@ -21,6 +21,8 @@
 
 #include <stdint.h>
 #include "Packet.hh"
+#include "CircularBuffer.hh"
+#include "BuildFile.hh"
 
 namespace sdcard {
 
@@ -38,14 +40,31 @@ typedef enum {
   SD_ERR_NO_ROOT          = 5,  // No root directory found
   SD_ERR_CARD_LOCKED      = 6,  // Card is locked, writing forbidden
   SD_ERR_FILE_NOT_FOUND   = 7,  // Could not find specific file
-  SD_ERR_GENERIC          = 8   // General error
+  SD_ERR_GENERIC          = 8,  // General error
+  SD_ERR_NO_INDEX_ENTRY   = 9,  // The build file has no such index entry
+  SD_ERR_BUSY             = 10, // A capture or playback is in progress
+  SD_ERR_NO_CHECKPOINT    = 11, // There is no build checkpoint to resume
+  SD_ERR_UNKNOWN_FORMAT   = 12, // The build file's encoding isn't known
+  SD_ERR_BAD_PLAYLIST     = 13, // The playlist has no entries, or a line
+                                //  is too long
+  SD_ERR_BAD_BLOCK        = 14  // A block of the build file failed its CRC
+                                //  or held a token that couldn't be decoded
 } SdErrorCode;
 
 /**
- * Reset the SD card subsystem.
+ * Reset the SD card subsystem, closing any open capture or playback.
+ * The card itself stays mounted.
  */
 void reset();
 
+/**
+ * Watch the card detect switch, and unmount the card when it is removed
+ * or swapped.  The card is mounted again on the next operation.  Also
+ * writes the blocks and index entries that capturePacket() leaves for
+ * later.
+ */
+void runSdSlice();
+
 /**
  * Start a directory scan.
  */
@@ -54,21 +73,33 @@ SdErrorCode directoryReset();
  * Get the next filename in a directory scan.
  */
 SdErrorCode directoryNextEntry(char* buffer, uint8_t bufsize);
+/**
+ * Step the directory scan back, so that the next call to
+ * directoryNextEntry() returns the same entry as the last one.
+ */
+void directoryUnreadEntry();
 
 /**************************/
 /** Build Capture         */
 /**************************/
 
 // Begin capturing bufffered commands to a new file with the given filename.
+// The file is written as an indexed build file (see BuildFile.hh).  If tee
+// is set, the commands are run as well as captured.
 // Returns an SD card error/success code.
-SdErrorCode startCapture(char* filename);
+SdErrorCode startCapture(char* filename, bool tee);
 // Capture the contents of a packet to the currently open file.
 void capturePacket(const Packet& packet);
-// Complete the capture, and flush buffers.  Return the number of bytes
-// written to the card.
+// Complete the capture, and flush buffers.  Return the number of command
+// bytes captured, not counting the build file header and CRCs.
 uint32_t finishCapture();
 // True if we're capturing buffered commands to a file, false otherwise
 bool isCapturing();
+// True if the commands being captured are also being run.
+bool isTeeing();
+// False while a full block of a tee capture waits to be written.  No more
+// commands can be captured until it has been.
+bool captureHasRoom();
 
 
 
@@ -79,14 +110,47 @@ bool isCapturing();
 // Begin playing back commands from a file on the SD card.
 // Returns an SD card error/success code.
 SdErrorCode startPlayback(char* filename);
+// Begin playing back commands from the given offset in a file's command
+// stream.
+SdErrorCode startPlaybackFrom(char* filename, uint32_t offset);
+// Begin playing back commands from the given entry of a build file's seek
+// index, and return the entry.  The machine should be at the entry's
+// position before the playback commands are run.
+SdErrorCode startPlaybackAt(char* filename, uint8_t index,
+		BuildIndexEntry& entry);
+// Play back the builds listed in a playlist file, one after another.
+// Returns an error if the playlist or its first file can't be read.
+SdErrorCode startPlaylist(char* filename);
+// True if the playback is working through a playlist.
+bool isPlayingPlaylist();
+// Read the header of a build file.  A file without one is reported as
+// version 0, with its size as the byte count.
+SdErrorCode getBuildInfo(char* filename, BuildHeader& header);
+// Read an entry of a build file's seek index.
+SdErrorCode getBuildIndexEntry(char* filename, uint8_t index,
+		BuildIndexEntry& entry);
 // See if there is more data available in the playback file.
 bool playbackHasNext();
 // Return the next byte from the currently open file.
 uint8_t playbackNext();
+// Move as many bytes as will fit from the playback file into the given
+// buffer.  Bytes are copied a run at a time rather than one by one.
+void playbackFill(CircularBuffer& buf);
+// Offset in the command stream of the next byte to be played back.
+uint32_t playbackPosition();
+// Size on the card of the file being played back.
+uint32_t playbackFileSize();
+// Length of the command stream being played back, or BUILD_LENGTH_UNKNOWN
+// for a capture that was never finished.
+uint32_t playbackLength();
 // Rewind the given number of bytes in the input stream.
 void playbackRewind(uint8_t bytes);
-// Halt playback.  Should be called at the end of playback, or on manual
-// halt; frees up resources.
+// SD_ERR_BAD_BLOCK if the playback was stopped by a corrupt block of the
+// file, otherwise SD_SUCCESS.  A bad block ends the playback early; it
+// doesn't look like the end of the file here.
+SdErrorCode playbackError();
+// Halt playback, including any playlist.  Should be called at the end of
+// playback, or on manual halt; frees up resources.
 void finishPlayback();
 // True if we're playing back buffered commands from a file, false otherwise
 bool isPlaying();
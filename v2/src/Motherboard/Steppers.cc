@@ -178,11 +178,34 @@ const Point getPosition() {
 
 bool holdZ = false;
 
+/// Speed of queued moves, as a percentage of the speed they ask for
+uint8_t speed_override = 100;
+
+void setSpeedOverride(uint8_t percent) {
+	if (percent < MIN_SPEED_OVERRIDE) { percent = MIN_SPEED_OVERRIDE; }
+	speed_override = percent;
+}
+
+uint8_t getSpeedOverride() {
+	return speed_override;
+}
+
+/// Scale the duration of a move by the speed override, without
+/// overflowing for long moves.
+int32_t scaleDuration(int32_t duration) {
+	if (speed_override == 100) {
+		return duration;
+	}
+	return (duration / speed_override) * 100 +
+			((duration % speed_override) * 100) / speed_override;
+}
+
 void setHoldZ(bool holdZ_in) {
 	holdZ = holdZ_in;
 }
 
 void setTarget(const Point& target, int32_t dda_interval) {
+	dda_interval = scaleDuration(dda_interval);
 	int32_t max_delta = 0;
 	for (int i = 0; i < AXIS_COUNT; i++) {
 		axes[i].setTarget(target[i], false);
@@ -205,6 +228,7 @@ void setTarget(const Point& target, int32_t dda_interval) {
 }
 
 void setTargetNew(const Point& target, int32_t us, uint8_t relative) {
+	us = scaleDuration(us);
 	for (int i = 0; i < AXIS_COUNT; i++) {
 		axes[i].setTarget(target[i], (relative & (1 << i)) != 0);
 		// Only shut z axis on inactivity
@@ -54,6 +54,13 @@ bool doInterrupt();
 const Point getPosition();
 /// Turn on in-build Z hold.  Defaults to off.
 void setHoldZ(bool holdZ);
+/// Least speed override accepted, in percent
+#define MIN_SPEED_OVERRIDE 10
+/// Run moves at the given percentage of the speed they ask for, from the
+/// next move on.  Homing is unaffected.  Defaults to 100.
+void setSpeedOverride(uint8_t percent);
+/// Get the speed override, in percent
+uint8_t getSpeedOverride();
 };
 
 #endif // STEPPERS_HH_
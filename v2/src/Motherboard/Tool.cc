@@ -32,9 +32,49 @@ OutPacket& getOutPacket() {
 	return Motherboard::getBoard().getSlaveUART().out;
 }
 
+// Initial round-trip timeout, used before we have measured a tool's
+// response time and for broadcast packets.
 #define TOOL_PACKET_TIMEOUT_MS 50L
 #define TOOL_PACKET_TIMEOUT_MICROS (1000L*TOOL_PACKET_TIMEOUT_MS)
 
+// Bounds on the timeout derived from the measured round-trip time.
+#define TOOL_PACKET_TIMEOUT_MIN_MICROS (4L*1000L)
+#define TOOL_PACKET_TIMEOUT_MAX_MICROS (2L*TOOL_PACKET_TIMEOUT_MICROS)
+
+// Bytes framing each packet on the wire: the start byte, length and CRC.
+#define PACKET_FRAMING_BYTES 3
+
+// Number of consecutive failed transactions before a tool is considered
+// offline.
+#define TOOL_OFFLINE_THRESHOLD 3
+// While a tool is offline, we only probe it at these intervals.  The interval
+// doubles on every failed probe.
+#define TOOL_PROBE_INTERVAL_MIN_MICROS (1000L*1000L)
+#define TOOL_PROBE_INTERVAL_MAX_MICROS (16L*1000L*1000L)
+
+// The tools start at this rate, and return to it after every reset.
+#define SLAVE_DEFAULT_BAUD_RATE BaudRate::BAUD_38400
+// Rate to negotiate with the tools after a reset.  Boards may override this
+// in their Configuration.hh; set it to the default rate to disable
+// negotiation.  Only tools 0 to TOOL_LINK_COUNT-1 are asked to change rate,
+// so the fast rate is dropped until the next reset as soon as any other tool
+// is addressed.
+#ifndef SLAVE_FAST_BAUD_RATE
+#define SLAVE_FAST_BAUD_RATE BaudRate::BAUD_115200
+#endif
+// Time a tool waits for a valid packet at a new rate before falling back to
+// the default rate.  Must match BAUD_RATE_CONFIRM_MS in the extruder.
+#define SLAVE_BAUD_RATE_CONFIRM_MICROS (1000L*1000L)
+// Time allowed for the tools to come back up after SLAVE_CMD_INIT.
+#define TOOL_RESET_SETTLE_MICROS (20L*1000L)
+// After falling back to the default rate, we try the fast rate again after
+// this interval, doubling it on every fallback.  The minimum leaves time for
+// any tools still at the fast rate to fall back on their own.
+#define TOOL_RENEGOTIATE_MIN_MICROS (2L*SLAVE_BAUD_RATE_CONFIRM_MICROS)
+#define TOOL_RENEGOTIATE_MAX_MICROS (64L*1000L*1000L)
+// Clean transactions at the fast rate after which the interval starts over.
+#define TOOL_RENEGOTIATE_CLEAN_TRANSACTIONS 200
+
 bool transaction_active = false;
 bool locked = false;
 uint8_t retries = RETRIES;
@@ -43,33 +83,315 @@ Timeout timeout;
 
 uint8_t tool_index = 0;
 
-bool reset() {
-	// This code is very lightly modified from handleToolQuery in Host.cc.
-	// We don't give up if we fail to get a lock; we force it instead.
-	Timeout acquire_lock_timeout;
-	acquire_lock_timeout.start(TOOL_PACKET_TIMEOUT_MICROS*2);
-	while (!tool::getLock()) {
-		if (acquire_lock_timeout.hasElapsed()) {
-			locked = true; // grant ourselves the lock
-			transaction_active = false; // abort transaction!
-			Motherboard::getBoard().indicateError(ERR_SLAVE_LOCK_TIMEOUT);
-			break;
+LinkStats link_stats[TOOL_LINK_COUNT];
+/// Probe timers for offline tools
+Timeout probe_timeout[TOOL_LINK_COUNT];
+
+/// Link statistics for the tool addressed by the current transaction; null
+/// for broadcasts and out-of-range indices.
+LinkStats* current_link = 0;
+/// Timeout used for the current attempt of the current transaction.
+micros_t current_timeout_micros;
+/// Time at which the current attempt was sent.
+micros_t send_stamp_micros;
+/// True if the current packet has been resent at least once.
+bool resent = false;
+/// Set while negotiating the link rate.  Failures are expected then (we
+/// probe for tools that may not exist), so they aren't reported, don't
+/// count against the tool and don't trigger a rate fallback.
+bool negotiating = false;
+
+/// Set when a rate negotiation is due once negotiate_timeout has elapsed.
+bool negotiate_pending = false;
+/// Set if the next negotiation should look for every tool, rather than just
+/// the ones that have answered since the last reset.
+bool negotiate_all = false;
+/// Cleared once a tool we don't negotiate with has been addressed.
+bool fast_rate_allowed = true;
+Timeout negotiate_timeout;
+micros_t negotiate_interval_micros = TOOL_RENEGOTIATE_MIN_MICROS;
+uint8_t clean_fast_transactions = 0;
+/// Tools that have answered since the last reset, one bit per index.
+uint8_t tools_seen = 0;
+
+/// Time the slave UART takes to send a packet with the given payload
+/// length at its current rate, at ten bits a byte.
+micros_t wireMicros(uint8_t payload_length) {
+	const uint32_t bits = 10L * (payload_length + PACKET_FRAMING_BYTES);
+	const uint32_t bps =
+			baudRateToBps(Motherboard::getBoard().getSlaveUART().getRate());
+	return bits * 1000000L / bps;
+}
+
+const LinkStats* getLinkStats(uint8_t index) {
+	if (index >= TOOL_LINK_COUNT) return 0;
+	return &link_stats[index];
+}
+
+/// Reset the round-trip estimates and offline state of all tools.  The
+/// error counters are only cleared on power-up, so that they accumulate
+/// across host connections.
+void resetLinkEstimates() {
+	for (uint8_t i = 0; i < TOOL_LINK_COUNT; i++) {
+		LinkStats& ls = link_stats[i];
+		ls.srtt_micros = 0;
+		ls.rttvar_micros = 0;
+		ls.rto_micros = TOOL_PACKET_TIMEOUT_MICROS;
+		ls.consecutive_failures = 0;
+		ls.probe_interval_micros = TOOL_PROBE_INTERVAL_MIN_MICROS;
+		ls.online = true;
+	}
+}
+
+/// Fold a round-trip sample into the smoothed estimate and variance
+/// (Jacobson/Karels), and recompute the timeout.
+void updateRtt(LinkStats& ls, micros_t rtt) {
+	if (ls.srtt_micros == 0) {
+		ls.srtt_micros = rtt;
+		ls.rttvar_micros = rtt / 2;
+	} else {
+		int32_t err = (int32_t)rtt - (int32_t)ls.srtt_micros;
+		ls.srtt_micros += err / 8;
+		if (err < 0) err = -err;
+		ls.rttvar_micros += (err - (int32_t)ls.rttvar_micros) / 4;
+	}
+	micros_t rto = ls.srtt_micros + 4 * ls.rttvar_micros;
+	if (rto < TOOL_PACKET_TIMEOUT_MIN_MICROS) rto = TOOL_PACKET_TIMEOUT_MIN_MICROS;
+	if (rto > TOOL_PACKET_TIMEOUT_MAX_MICROS) rto = TOOL_PACKET_TIMEOUT_MAX_MICROS;
+	ls.rto_micros = rto;
+}
+
+/// Schedule another try at the fast rate after the backoff interval.
+void scheduleNegotiation() {
+	if (!fast_rate_allowed) return;
+	negotiate_pending = true;
+	negotiate_timeout.start(negotiate_interval_micros);
+	negotiate_interval_micros *= 2;
+	if (negotiate_interval_micros > TOOL_RENEGOTIATE_MAX_MICROS) {
+		negotiate_interval_micros = TOOL_RENEGOTIATE_MAX_MICROS;
+	}
+	clean_fast_transactions = 0;
+}
+
+void transactionSucceeded() {
+	// Once the fast rate has held up for a while, the next fallback is
+	// retried quickly again.
+	if (clean_fast_transactions < TOOL_RENEGOTIATE_CLEAN_TRANSACTIONS &&
+			Motherboard::getBoard().getSlaveUART().getRate() !=
+			SLAVE_DEFAULT_BAUD_RATE) {
+		if (++clean_fast_transactions == TOOL_RENEGOTIATE_CLEAN_TRANSACTIONS) {
+			negotiate_interval_micros = TOOL_RENEGOTIATE_MIN_MICROS;
 		}
 	}
+	if (current_link == 0) return;
+	tools_seen |= _BV(current_link - link_stats);
+	// Karn's rule: only sample the round trip of unambiguous, first-attempt
+	// responses.  The time the packets took to send is taken out, so that
+	// long packets don't skew the estimate; it is added back per packet.
+	if (!resent) {
+		micros_t rtt =
+				Motherboard::getBoard().getCurrentMicros() - send_stamp_micros;
+		const micros_t wire = wireMicros(getOutPacket().getLength()) +
+				wireMicros(getInPacket().getLength());
+		rtt = (rtt > wire) ? rtt - wire : 1;
+		updateRtt(*current_link, rtt);
+	}
+	current_link->consecutive_failures = 0;
+	current_link->probe_interval_micros = TOOL_PROBE_INTERVAL_MIN_MICROS;
+	current_link->online = true;
+}
+
+void transactionFailed() {
+	UART& uart = Motherboard::getBoard().getSlaveUART();
+	if (!negotiating && uart.getRate() != SLAVE_DEFAULT_BAUD_RATE) {
+		// The tool may have been reset behind our back; drop to the rate
+		// it starts at.  Any tools still at the fast rate will fall back
+		// once they stop hearing valid packets.
+		uart.setRate(SLAVE_DEFAULT_BAUD_RATE);
+		scheduleNegotiation();
+	}
+	if (negotiating || current_link == 0) return;
+	LinkStats& ls = *current_link;
+	ls.failures++;
+	if (!ls.online) {
+		// Failed probe; back off further.
+		ls.probe_interval_micros *= 2;
+		if (ls.probe_interval_micros > TOOL_PROBE_INTERVAL_MAX_MICROS) {
+			ls.probe_interval_micros = TOOL_PROBE_INTERVAL_MAX_MICROS;
+		}
+	} else if (++ls.consecutive_failures >= TOOL_OFFLINE_THRESHOLD) {
+		ls.online = false;
+	}
+	if (!ls.online) {
+		probe_timeout[current_link - link_stats].start(ls.probe_interval_micros);
+	}
+}
+
+/// Resend the current packet, backing off the timeout.
+void retry() {
+	retries--;
+	resent = true;
+	current_timeout_micros *= 2;
+	if (current_timeout_micros > TOOL_PACKET_TIMEOUT_MAX_MICROS) {
+		current_timeout_micros = TOOL_PACKET_TIMEOUT_MAX_MICROS;
+	}
+	if (current_link != 0) current_link->retries++;
+	UART& uart = Motherboard::getBoard().getSlaveUART();
+	timeout.start(current_timeout_micros);
+	send_stamp_micros = Motherboard::getBoard().getCurrentMicros();
+	uart.out.prepareForResend();
+	uart.in.reset();
+	uart.reset();
+	uart.beginSend();
+}
+
+/// Send the packet in the output buffer and block until the transaction
+/// is done.  Assumes that the caller holds the lock.  Returns true if the
+/// tool responded.
+bool runTransaction(bool single_attempt) {
+	startTransaction();
+	if (single_attempt) {
+		retries = 0;
+	}
+	// WHILE: bounded by tool timeout
+	while (!isTransactionDone()) {
+		runToolSlice();
+	}
+	return getInPacket().isFinished();
+}
+
+/// Ask a tool to switch to the given rate.  Returns true if the tool
+/// responded; the response code is left in the input packet.
+bool sendSetBaudRate(uint8_t index, uint8_t rate, bool single_attempt) {
 	OutPacket& out = getOutPacket();
+	out.reset();
+	out.append8(index);
+	out.append8(SLAVE_CMD_SET_BAUD_RATE);
+	out.append8(rate);
+	return runTransaction(single_attempt);
+}
+
+/// Ask each of the tools in the mask to go back to the default rate.
+/// Assumes that the bus is at the fast rate.
+void revertBaudRate(uint8_t tools) {
+	for (uint8_t i = 0; i < TOOL_LINK_COUNT; i++) {
+		if (tools & _BV(i)) {
+			sendSetBaudRate(i, SLAVE_DEFAULT_BAUD_RATE, true);
+		}
+	}
+}
+
+/// Try to move every tool on the bus to SLAVE_FAST_BAUD_RATE.  Since the bus
+/// is shared, this only succeeds if every tool that answers accepts the new
+/// rate and then answers a ping at it; otherwise everyone stays at the
+/// default rate.  A tool that refuses keeps the bus at the default rate
+/// until the next reset; a failed ping is tried again later.  Assumes that
+/// the caller holds the lock and that the bus is at the default rate.
+void negotiateBaudRate() {
+	negotiate_pending = false;
+	if (SLAVE_FAST_BAUD_RATE == SLAVE_DEFAULT_BAUD_RATE) return;
+	UART& uart = Motherboard::getBoard().getSlaveUART();
 	InPacket& in = getInPacket();
+	negotiating = true;
+	uint8_t accepted = 0;
+	bool refused = false;
+	for (uint8_t i = 0; i < TOOL_LINK_COUNT; i++) {
+		// After a reset we look for every tool; later we only ask the ones
+		// we know about, so that missing tools don't stall the build.
+		if (!negotiate_all && (tools_seen & _BV(i)) == 0) continue;
+		// A single attempt is enough to find out whether a tool is there.
+		if (!sendSetBaudRate(i, SLAVE_FAST_BAUD_RATE, true)) continue;
+		if (in.read8(0) == RC_OK) {
+			accepted |= _BV(i);
+		} else {
+			refused = true;
+		}
+	}
+	negotiate_all = false;
+	if (accepted != 0) {
+		uart.setRate(SLAVE_FAST_BAUD_RATE);
+		uint8_t confirmed = 0;
+		if (!refused) {
+			for (uint8_t i = 0; i < TOOL_LINK_COUNT; i++) {
+				if ((accepted & _BV(i)) == 0) continue;
+				OutPacket& out = getOutPacket();
+				out.reset();
+				out.append8(i);
+				out.append8(SLAVE_CMD_VERSION);
+				if (!runTransaction(true)) break;
+				confirmed |= _BV(i);
+			}
+		}
+		if (confirmed != accepted) {
+			// Put the tools that did make it back at the default rate.
+			revertBaudRate(accepted);
+			uart.setRate(SLAVE_DEFAULT_BAUD_RATE);
+			if (!refused) {
+				scheduleNegotiation();
+			}
+		}
+	}
+	negotiating = false;
+}
+
+/// Broadcast SLAVE_CMD_INIT at the slave UART's current rate.
+bool sendInit(bool single_attempt) {
+	OutPacket& out = getOutPacket();
 	out.reset();
 	out.append8(255); // Reset all tools
 	out.append8(SLAVE_CMD_INIT);
 	startTransaction();
+	if (single_attempt) {
+		retries = 0;
+	}
 	// override standard timeout
 	timeout.start(TOOL_PACKET_TIMEOUT_MICROS*2);
-	releaseLock();
 	// WHILE: bounded by tool timeout
 	while (!isTransactionDone()) {
 		runToolSlice(); // This will most likely time out if there's multiple toolheads.
 	}
-	return Motherboard::getBoard().getSlaveUART().in.isFinished();
+	return getInPacket().isFinished();
+}
+
+bool reset() {
+	// This code is very lightly modified from handleToolQuery in Host.cc.
+	// We don't give up if we fail to get a lock; we force it instead.
+	Timeout acquire_lock_timeout;
+	acquire_lock_timeout.start(TOOL_PACKET_TIMEOUT_MICROS*2);
+	while (!tool::getLock()) {
+		if (acquire_lock_timeout.hasElapsed()) {
+			locked = true; // grant ourselves the lock
+			transaction_active = false; // abort transaction!
+			Motherboard::getBoard().indicateError(ERR_SLAVE_LOCK_TIMEOUT);
+			break;
+		}
+	}
+	// Forget the timing we learned about the tools; they may have been
+	// swapped or recabled.
+	resetLinkEstimates();
+	UART& uart = Motherboard::getBoard().getSlaveUART();
+	const uint8_t rate = uart.getRate();
+	bool responded = sendInit(false);
+	if (!responded && rate != SLAVE_FAST_BAUD_RATE) {
+		// We may have been reset while the tools were left at the fast rate.
+		// Several tools answering at once never gets a response, so don't
+		// keep trying.
+		negotiating = true;
+		uart.setRate(SLAVE_FAST_BAUD_RATE);
+		responded = sendInit(true);
+		negotiating = false;
+	}
+	// Tools return to the default rate on reset.  Negotiate a faster one
+	// from runToolSlice once they have had time to come back up.
+	uart.setRate(SLAVE_DEFAULT_BAUD_RATE);
+	tools_seen = 0;
+	fast_rate_allowed = true;
+	negotiate_all = true;
+	negotiate_pending = true;
+	negotiate_interval_micros = TOOL_RENEGOTIATE_MIN_MICROS;
+	negotiate_timeout.start(TOOL_RESET_SETTLE_MICROS);
+	releaseLock();
+	return responded;
 }
 
 /// The tool is considered locked if a transaction is in progress or
@@ -86,11 +408,46 @@ void releaseLock() {
 }
 
 void startTransaction() {
-	transaction_active = true;
-	timeout.start(TOOL_PACKET_TIMEOUT_MICROS); // 50 ms timeout
+	UART& uart = Motherboard::getBoard().getSlaveUART();
+	const uint8_t index = uart.out.read8(0);
+	current_link = (index < TOOL_LINK_COUNT) ? &link_stats[index] : 0;
+	if (current_link == 0 && index != 255 && fast_rate_allowed) {
+		// This tool was never asked to change rate, so talk to it at the
+		// default rate from now on.  The tools at the fast rate will fall
+		// back once they stop hearing valid packets.
+		fast_rate_allowed = false;
+		negotiate_pending = false;
+		uart.setRate(SLAVE_DEFAULT_BAUD_RATE);
+	}
 	retries = RETRIES;
-	Motherboard::getBoard().getSlaveUART().in.reset();
-	Motherboard::getBoard().getSlaveUART().beginSend();
+	resent = false;
+	current_timeout_micros = TOOL_PACKET_TIMEOUT_MICROS;
+	if (current_link != 0) {
+		LinkStats& ls = *current_link;
+		ls.transactions++;
+		// Allow for sending the packet and the longest reply at the bus
+		// rate, which the round-trip estimate leaves out.
+		current_timeout_micros = ls.rto_micros +
+				wireMicros(uart.out.getLength()) +
+				wireMicros(MAX_PACKET_PAYLOAD);
+		if (!ls.online) {
+			if (!probe_timeout[index].hasElapsed()) {
+				// Fail fast rather than stalling on a tool that isn't there.
+				uart.in.reset();
+				uart.in.timeout();
+				transaction_active = false;
+				return;
+			}
+			// Probe with a single, full-length attempt.
+			retries = 0;
+			current_timeout_micros = TOOL_PACKET_TIMEOUT_MAX_MICROS;
+		}
+	}
+	transaction_active = true;
+	timeout.start(current_timeout_micros);
+	send_stamp_micros = Motherboard::getBoard().getCurrentMicros();
+	uart.in.reset();
+	uart.beginSend();
 }
 
 bool isTransactionDone() {
@@ -103,33 +460,39 @@ void runToolSlice() {
 		if (uart.in.isFinished())
 		{
 			transaction_active = false;
+			transactionSucceeded();
 		} else if (uart.in.hasError()) {
+			if (current_link != 0 &&
+					uart.in.getErrorCode() == PacketError::BAD_CRC) {
+				current_link->crc_errors++;
+			}
 			if (retries) {
-				retries--;
-				timeout.start(TOOL_PACKET_TIMEOUT_MICROS); // 50 ms timeout
-				uart.out.prepareForResend();
-				uart.in.reset();
-				uart.reset();
-				uart.beginSend();
+				retry();
 			} else {
 				transaction_active = false;
-				Motherboard::getBoard().indicateError(ERR_SLAVE_PACKET_MISC);
+				transactionFailed();
+				if (!negotiating) {
+					Motherboard::getBoard().indicateError(ERR_SLAVE_PACKET_MISC);
+				}
 			}
 		} else if (timeout.hasElapsed()) {
+			if (current_link != 0) current_link->timeouts++;
 			if (retries) {
-				retries--;
-				timeout.start(TOOL_PACKET_TIMEOUT_MICROS); // 50 ms timeout
-				uart.out.prepareForResend();
-				uart.in.reset();
-				uart.reset();
-				uart.beginSend();
+				retry();
 			} else {
 				uart.in.timeout();
 				uart.reset();
 				transaction_active = false;
-				Motherboard::getBoard().indicateError(ERR_SLAVE_PACKET_TIMEOUT);
+				transactionFailed();
+				if (!negotiating) {
+					Motherboard::getBoard().indicateError(ERR_SLAVE_PACKET_TIMEOUT);
+				}
 			}
 		}
+	} else if (negotiate_pending && negotiate_timeout.hasElapsed() &&
+			getLock()) {
+		negotiateBaudRate();
+		releaseLock();
 	}
 }
 
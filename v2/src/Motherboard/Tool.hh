@@ -19,6 +19,7 @@
 #define TOOL_HH_
 
 #include "Packet.hh"
+#include "Types.hh"
 
 /***
  * There are three fundamental ways to initiate a tool interaction.  They are:
@@ -36,6 +37,44 @@
  */
 namespace tool {
 
+/// Number of tool indices for which we track link statistics.  Packets
+/// addressed to other indices (including the 255 broadcast) use the
+/// default timeout and are not tracked.  Only these tools are asked to move
+/// to the fast bus rate; addressing any other tool keeps the bus at the
+/// default rate until the next reset.
+#define TOOL_LINK_COUNT 4
+
+/**
+ * Per-tool link statistics.  The round-trip estimate is maintained from
+ * first-attempt responses, and the timeout for each transaction is derived
+ * from it, plus the time to send the packet and the longest reply at the
+ * bus rate.  A tool that repeatedly fails to respond is marked offline and
+ * only probed occasionally until it answers again.
+ */
+struct LinkStats {
+	/// Smoothed round-trip time, in microseconds, not counting the time
+	/// the packets take to send; 0 if not yet measured.
+	micros_t srtt_micros;
+	/// Smoothed round-trip deviation, in microseconds.
+	micros_t rttvar_micros;
+	/// Current per-attempt timeout, in microseconds, before the time to
+	/// send the packets is added.
+	micros_t rto_micros;
+	/// Transactions started to this tool.
+	uint32_t transactions;
+	/// Packets resent after an error or timeout.
+	uint16_t retries;
+	/// Responses received with a bad CRC.
+	uint16_t crc_errors;
+	/// Attempts that timed out waiting for a response.
+	uint16_t timeouts;
+	/// Transactions that failed after exhausting all retries.
+	uint16_t failures;
+	uint8_t consecutive_failures;
+	micros_t probe_interval_micros;
+	bool online;
+};
+
 /**
  * Run the tool maintenance timeslice.  Checks for tool command timeouts,
  * etc.
@@ -74,10 +113,17 @@ InPacket& getInPacket();
 
 /**
  * Immediately reset the tool.  Returns true if
- * tool responded to reset; false otherwise.
+ * tool responded to reset; false otherwise.  A faster bus rate is
+ * negotiated later, from runToolSlice.
  */
 bool reset();
 
+/**
+ * Get the link statistics for the given tool index, or 0 if the index
+ * is not tracked.
+ */
+const LinkStats* getLinkStats(uint8_t index);
+
 extern uint8_t tool_index;
 }
 
@@ -62,6 +62,9 @@
 
 // --- Host UART configuration ---
 // The host UART is presumed to always be present on the RX/TX lines.
+// The rate the host UART starts at (see BaudRate.hh).  The host may switch
+// to a faster rate at runtime with HOST_CMD_SET_BAUD_RATE.
+#define HOST_DEFAULT_BAUD_RATE BaudRate::BAUD_115200
 
 // --- Piezo Buzzer configuration ---
 // Define as 1 if the piezo buzzer is present, 0 if not.
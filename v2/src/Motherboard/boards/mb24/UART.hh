@@ -19,6 +19,7 @@
 #define BOARDS_RRMBV12_UART_HH_
 
 #include "Packet.hh"
+#include "BaudRate.hh"
 #include <stdint.h>
 
 /**
@@ -32,12 +33,19 @@ class UART {
 private:
 	const uint8_t index_;
 	volatile bool enabled_;
+	uint8_t rate_;
 public:
 	UART(uint8_t index);
 	InPacket in;
 	OutPacket out;
 	void beginSend();
 	void enable(bool enabled);
+	/// Switch the UART to the given bit rate (see BaudRate.hh).  If a
+	/// packet is being transmitted, the switch is deferred until its last
+	/// byte has left the shift register.
+	void setRate(uint8_t rate);
+	/// Get the current bit rate code.
+	uint8_t getRate() const { return rate_; }
 	static UART& getHostUART() { return uart[0]; }
 	static UART& getSlaveUART() { return uart[1]; }
 	// Reset the UART to a listening state.  This is important for
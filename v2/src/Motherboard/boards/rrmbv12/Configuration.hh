@@ -65,6 +65,9 @@
 
 // --- Host UART configuration ---
 // The host UART is presumed to always be present on the RX/TX lines.
+// The rate the host UART starts at (see BaudRate.hh).  The host may switch
+// to a faster rate at runtime with HOST_CMD_SET_BAUD_RATE.
+#define HOST_DEFAULT_BAUD_RATE BaudRate::BAUD_38400
 
 // --- Axis configuration ---
 // Define the number of stepper axes supported by the board.  The axes are
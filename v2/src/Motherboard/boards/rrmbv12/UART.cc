@@ -20,6 +20,7 @@
 #include <avr/sfr_defs.h>
 #include <avr/interrupt.h>
 #include <avr/io.h>
+#include <util/atomic.h>
 #include "Configuration.hh"
 
 // MEGA644P_DOUBLE_SPEED_MODE is 1 if USXn is 1.
@@ -48,6 +49,15 @@
     /* defaults to 8-bit, no parity, 1 stop bit */ \
 }
 
+/// Reprogram the rate of a running UART.  Runtime rate changes always use
+/// double speed mode, which gives the closest divisors at the higher rates.
+#define SET_SERIAL_RATE(uart_,ubrr_) \
+{ \
+    UBRR##uart_##H = (ubrr_) >> 8; \
+    UBRR##uart_##L = (ubrr_) & 0xff; \
+    UCSR##uart_##A = _BV(U2X##uart_); \
+}
+
 #define ENABLE_SERIAL_INTERRUPTS(uart_) \
 { \
 	UCSR##uart_##B |=  _BV(RXCIE##uart_) | _BV(TXCIE##uart_); \
@@ -58,11 +68,38 @@
 	UCSR##uart_##B &= ~(_BV(RXCIE##uart_) | _BV(TXCIE##uart_)); \
 }
 
+inline void applyRate(uint8_t index, uint8_t rate) {
+	const uint16_t ubrr = baudRateToUbrr(rate);
+	if (index == 0) {
+		SET_SERIAL_RATE(0,ubrr);
+	} else if (index == 1) {
+		SET_SERIAL_RATE(1,ubrr);
+	}
+}
+
 UART UART::uart[2] = {
 		UART(0),
 		UART(1)
 };
 
+// True from the start of a packet transmission until its last byte has
+// been shifted out, per UART.
+volatile bool transmitting[2] = { false, false };
+
+#define NO_PENDING_RATE 0xff
+// Rate changes to apply once the current transmission completes, per UART.
+volatile uint8_t pending_rate[2] = { NO_PENDING_RATE, NO_PENDING_RATE };
+
+/// Called from the tx complete interrupt once the last byte of a packet
+/// has gone out.
+inline void transmissionDone(uint8_t index) {
+	transmitting[index] = false;
+	if (pending_rate[index] != NO_PENDING_RATE) {
+		applyRate(index, pending_rate[index]);
+		pending_rate[index] = NO_PENDING_RATE;
+	}
+}
+
 // This keeps track of the number of bytes that have been sent
 // and need to be discarded due to loopback.
 volatile uint8_t loopback_bytes = 0; // Only applies to UART1, the rs485
@@ -76,7 +113,8 @@ inline void speak() {
 	TX_ENABLE_PIN.setValue(true);
 }
 
-UART::UART(uint8_t index) : index_(index), enabled_(false) {
+UART::UART(uint8_t index) : index_(index), enabled_(false),
+		rate_(index == 0 ? HOST_DEFAULT_BAUD_RATE : BaudRate::BAUD_38400) {
 	if (index_ == 0) {
 		INIT_SERIAL(0);
 	} else if (index_ == 1) {
@@ -98,6 +136,7 @@ UART::UART(uint8_t index) : index_(index), enabled_(false) {
 void UART::beginSend() {
 	if (!enabled_) { return; }
 	uint8_t send_byte = out.getNextByteToSend();
+	transmitting[index_] = true;
 	if (index_ == 0) {
 		UDR0 = send_byte;
 	} else if (index_ == 1) {
@@ -118,6 +157,18 @@ void UART::enable(bool enabled) {
 	}
 }
 
+void UART::setRate(uint8_t rate) {
+	if (rate >= BaudRate::COUNT) { return; }
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		rate_ = rate;
+		if (transmitting[index_]) {
+			pending_rate[index_] = rate;
+		} else {
+			applyRate(index_, rate);
+		}
+	}
+}
+
 // Reset the UART to a listening state.  This is important for
 // RS485-based comms.  Because this resets the loopback count,
 // it should only be called after a timeout or read error.
@@ -151,6 +202,8 @@ ISR(USART0_TX_vect)
 {
 	if (UART::uart[0].out.isSending()) {
 		UDR0 = UART::uart[0].out.getNextByteToSend();
+	} else {
+		transmissionDone(0);
 	}
 }
 
@@ -161,6 +214,7 @@ ISR(USART1_TX_vect)
 		UDR1 = UART::uart[1].out.getNextByteToSend();
 	} else {
 		listen();
+		transmissionDone(1);
 	}
 }
 
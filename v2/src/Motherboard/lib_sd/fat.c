@@ -161,6 +161,14 @@ struct fat_fs_struct
     cluster_t cluster_free;
 };
 
+#if FAT_CLUSTER_RUN_COUNT
+struct fat_cluster_run_struct
+{
+    cluster_t start;
+    cluster_t length;
+};
+#endif
+
 struct fat_file_struct
 {
     struct fat_fs_struct* fs;
@@ -170,6 +178,11 @@ struct fat_file_struct
 #ifdef FAT_DELAY_DIRENTRY_UPDATE
     uint8_t needs_write;
 #endif
+#if FAT_CLUSTER_RUN_COUNT
+    /* the first runs of the file's cluster chain, in chain order */
+    struct fat_cluster_run_struct cluster_runs[FAT_CLUSTER_RUN_COUNT];
+    uint8_t cluster_run_count;
+#endif
 };
 
 struct fat_dir_struct
@@ -205,6 +218,10 @@ static struct fat_dir_struct fat_dir_handles[FAT_DIR_COUNT];
 static uint8_t fat_read_header(struct fat_fs_struct* fs);
 static cluster_t fat_get_next_cluster(const struct fat_fs_struct* fs, cluster_t cluster_num);
 static offset_t fat_cluster_offset(const struct fat_fs_struct* fs, cluster_t cluster_num);
+#if FAT_CLUSTER_RUN_COUNT
+static cluster_t fat_file_next_cluster(struct fat_file_struct* fd, cluster_t cluster_num);
+static cluster_t fat_file_cluster_at(struct fat_file_struct* fd, uint32_t cluster_index);
+#endif
 static uint8_t fat_dir_entry_read_callback(uint8_t* buffer, offset_t offset, void* p);
 #if FAT_LFN_SUPPORT
 static uint8_t fat_calc_83_checksum(const uint8_t* file_name_83);
@@ -957,6 +974,9 @@ struct fat_file_struct* fat_open_file(struct fat_fs_struct* fs, const struct fat
 #ifdef FAT_DELAY_DIRENTRY_UPDATE
 	fd->needs_write = 0;
 #endif
+#if FAT_CLUSTER_RUN_COUNT
+    fd->cluster_run_count = 0;
+#endif
 
     return fd;
 }
@@ -986,6 +1006,129 @@ void fat_close_file(struct fat_file_struct* fd)
     }
 }
 
+#if FAT_CLUSTER_RUN_COUNT
+/**
+ * \ingroup fat_file
+ * Appends a cluster to the run cache of a file.
+ *
+ * The cluster must be the successor of the last cached cluster, so that the
+ * cache stays a prefix of the chain.  If the cluster does not extend the last
+ * run and all runs are in use, the cluster is not cached.
+ *
+ * \param[in] fd The file handle.
+ * \param[in] cluster_num The cluster to append.
+ */
+static void fat_file_cache_cluster(struct fat_file_struct* fd, cluster_t cluster_num)
+{
+    struct fat_cluster_run_struct* run = &fd->cluster_runs[fd->cluster_run_count - 1];
+    if(cluster_num == run->start + run->length)
+    {
+        ++run->length;
+    }
+    else if(fd->cluster_run_count < FAT_CLUSTER_RUN_COUNT)
+    {
+        ++run;
+        run->start = cluster_num;
+        run->length = 1;
+        ++fd->cluster_run_count;
+    }
+}
+
+/**
+ * \ingroup fat_file
+ * Starts the run cache of a file with its first cluster, if it is empty.
+ *
+ * \param[in] fd The file handle.
+ * \returns 0 if the file has no clusters, 1 otherwise.
+ */
+static uint8_t fat_file_start_cache(struct fat_file_struct* fd)
+{
+    if(fd->cluster_run_count == 0)
+    {
+        if(!fd->dir_entry.cluster)
+            return 0;
+        fd->cluster_runs[0].start = fd->dir_entry.cluster;
+        fd->cluster_runs[0].length = 1;
+        fd->cluster_run_count = 1;
+    }
+    return 1;
+}
+
+/**
+ * \ingroup fat_file
+ * Retrieves the cluster following a given cluster of a file.
+ *
+ * Clusters within the cached runs are resolved without touching the FAT.
+ * Looking past the last cached cluster reads the FAT and extends the cache.
+ *
+ * \param[in] fd The file handle.
+ * \param[in] cluster_num The cluster of the file whose successor to find.
+ * \returns The next cluster, or 0 at the end of the chain or on failure.
+ */
+cluster_t fat_file_next_cluster(struct fat_file_struct* fd, cluster_t cluster_num)
+{
+    /* a file read or written from its start finds the cache empty */
+    fat_file_start_cache(fd);
+
+    struct fat_cluster_run_struct* run = fd->cluster_runs;
+    uint8_t i;
+    for(i = 0; i < fd->cluster_run_count; ++i, ++run)
+    {
+        if(cluster_num < run->start || cluster_num - run->start >= run->length)
+            continue;
+
+        if(cluster_num - run->start + 1 < run->length)
+            return cluster_num + 1;
+        if(i + 1 < fd->cluster_run_count)
+            return run[1].start;
+
+        /* last cached cluster, extend the cache */
+        cluster_t cluster_num_next = fat_get_next_cluster(fd->fs, cluster_num);
+        if(cluster_num_next)
+            fat_file_cache_cluster(fd, cluster_num_next);
+        return cluster_num_next;
+    }
+
+    return fat_get_next_cluster(fd->fs, cluster_num);
+}
+
+/**
+ * \ingroup fat_file
+ * Retrieves the cluster holding a given part of a file.
+ *
+ * \param[in] fd The file handle.
+ * \param[in] cluster_index The index of the cluster within the file's chain.
+ * \returns The cluster, or 0 if the chain is shorter or on failure.
+ */
+cluster_t fat_file_cluster_at(struct fat_file_struct* fd, uint32_t cluster_index)
+{
+    if(!fat_file_start_cache(fd))
+        return 0;
+
+    struct fat_cluster_run_struct* run = fd->cluster_runs;
+    uint8_t i;
+    for(i = 1; cluster_index >= run->length; ++i, ++run)
+    {
+        if(i >= fd->cluster_run_count)
+        {
+            /* walk the chain on from the last cached cluster */
+            cluster_t cluster_num = run->start + run->length - 1;
+            cluster_index -= run->length - 1;
+            while(cluster_index--)
+            {
+                cluster_num = fat_file_next_cluster(fd, cluster_num);
+                if(!cluster_num)
+                    return 0;
+            }
+            return cluster_num;
+        }
+        cluster_index -= run->length;
+    }
+
+    return run->start + cluster_index;
+}
+#endif
+
 /**
  * \ingroup fat_file
  * Reads data from a file.
@@ -1030,6 +1173,11 @@ intptr_t fat_read_file(struct fat_file_struct* fd, uint8_t* buffer, uintptr_t bu
 
         if(fd->pos)
         {
+#if FAT_CLUSTER_RUN_COUNT
+            cluster_num = fat_file_cluster_at(fd, fd->pos / cluster_size);
+            if(!cluster_num)
+                return -1;
+#else
             uint32_t pos = fd->pos;
             while(pos >= cluster_size)
             {
@@ -1038,6 +1186,7 @@ intptr_t fat_read_file(struct fat_file_struct* fd, uint8_t* buffer, uintptr_t bu
                 if(!cluster_num)
                     return -1;
             }
+#endif
         }
     }
     
@@ -1062,7 +1211,11 @@ intptr_t fat_read_file(struct fat_file_struct* fd, uint8_t* buffer, uintptr_t bu
         if(first_cluster_offset + copy_length >= cluster_size)
         {
             /* we are on a cluster boundary, so get the next cluster */
+#if FAT_CLUSTER_RUN_COUNT
+            if((cluster_num = fat_file_next_cluster(fd, cluster_num)))
+#else
             if((cluster_num = fat_get_next_cluster(fd->fs, cluster_num)))
+#endif
             {
                 first_cluster_offset = 0;
             }
@@ -1133,7 +1286,11 @@ intptr_t fat_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uintp
             while(pos >= cluster_size)
             {
                 pos -= cluster_size;
+#if FAT_CLUSTER_RUN_COUNT
+                cluster_num_next = fat_file_next_cluster(fd, cluster_num);
+#else
                 cluster_num_next = fat_get_next_cluster(fd->fs, cluster_num);
+#endif
                 if(!cluster_num_next && pos == 0)
                     /* the file exactly ends on a cluster boundary, and we append to it */
                     cluster_num_next = fat_append_clusters(fd->fs, cluster_num, 1);
@@ -1166,7 +1323,11 @@ intptr_t fat_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uintp
         if(first_cluster_offset + write_length >= cluster_size)
         {
             /* we are on a cluster boundary, so get the next cluster */
+#if FAT_CLUSTER_RUN_COUNT
+            cluster_t cluster_num_next = fat_file_next_cluster(fd, cluster_num);
+#else
             cluster_t cluster_num_next = fat_get_next_cluster(fd->fs, cluster_num);
+#endif
             if(!cluster_num_next && buffer_left > 0)
                 /* we reached the last cluster, append a new one */
                 cluster_num_next = fat_append_clusters(fd->fs, cluster_num, 1);
@@ -1305,6 +1466,13 @@ uint8_t fat_resize_file(struct fat_file_struct* fd, uint32_t size)
     uint16_t cluster_size = fd->fs->header.cluster_size;
     uint32_t size_new = size;
 
+#if FAT_CLUSTER_RUN_COUNT
+    /* walk the chain through the run cache; growing only appends to the
+     * chain, so the cache stays valid */
+    uint8_t shrinking = size < fd->dir_entry.file_size;
+    fat_file_cluster_at(fd, 0);
+#endif
+
     do
     {
         if(cluster_num == 0 && size_new == 0)
@@ -1315,7 +1483,11 @@ uint8_t fat_resize_file(struct fat_file_struct* fd, uint32_t size)
         while(size_new > cluster_size)
         {
             /* get next cluster of file */
+#if FAT_CLUSTER_RUN_COUNT
+            cluster_t cluster_num_next = fat_file_next_cluster(fd, cluster_num);
+#else
             cluster_t cluster_num_next = fat_get_next_cluster(fd->fs, cluster_num);
+#endif
             if(cluster_num_next)
             {
                 cluster_num = cluster_num_next;
@@ -1364,6 +1536,12 @@ uint8_t fat_resize_file(struct fat_file_struct* fd, uint32_t size)
 
     } while(0);
 
+#if FAT_CLUSTER_RUN_COUNT
+    /* the chain was cut short; forget what we know about it */
+    if(shrinking)
+        fd->cluster_run_count = 0;
+#endif
+
     /* correct file position */
     if(size < fd->pos)
     {
@@ -1568,6 +1746,48 @@ uint8_t fat_reset_dir(struct fat_dir_struct* dd)
     return 1;
 }
 
+/**
+ * \ingroup fat_dir
+ * Retrieves the position of a directory handle.
+ *
+ * The position can later be handed to fat_set_dir_pos(), so that the
+ * entry following it is read again without scanning the directory.
+ *
+ * \param[in] dd The directory handle.
+ * \param[out] pos The current position of the handle.
+ * \see fat_set_dir_pos
+ */
+void fat_get_dir_pos(const struct fat_dir_struct* dd, struct fat_dir_pos_struct* pos)
+{
+    if(!dd || !pos)
+        return;
+
+    pos->cluster = dd->entry_cluster;
+    pos->offset = dd->entry_offset;
+}
+
+/**
+ * \ingroup fat_dir
+ * Moves a directory handle to a position retrieved by fat_get_dir_pos().
+ *
+ * The position must have been taken from a handle on the same directory,
+ * and the directory must not have been modified since.
+ *
+ * \param[in] dd The directory handle.
+ * \param[in] pos The position to move to.
+ * \returns 0 on failure, 1 on success.
+ * \see fat_get_dir_pos
+ */
+uint8_t fat_set_dir_pos(struct fat_dir_struct* dd, const struct fat_dir_pos_struct* pos)
+{
+    if(!dd || !pos)
+        return 0;
+
+    dd->entry_cluster = pos->cluster;
+    dd->entry_offset = pos->offset;
+    return 1;
+}
+
 /**
  * \ingroup fat_fs
  * Callback function for reading a directory entry.
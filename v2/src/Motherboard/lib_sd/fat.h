@@ -65,6 +65,18 @@ struct fat_fs_struct;
 struct fat_file_struct;
 struct fat_dir_struct;
 
+/**
+ * \ingroup fat_dir
+ * Describes a position within a directory listing.
+ */
+struct fat_dir_pos_struct
+{
+    /** The cluster the position lies in, or 0 for the FAT16 root directory. */
+    cluster_t cluster;
+    /** The byte offset within the cluster. */
+    uint16_t offset;
+};
+
 /**
  * \ingroup fat_file
  * Describes a directory entry.
@@ -103,6 +115,8 @@ struct fat_dir_struct* fat_open_dir(struct fat_fs_struct* fs, const struct fat_d
 void fat_close_dir(struct fat_dir_struct* dd);
 uint8_t fat_read_dir(struct fat_dir_struct* dd, struct fat_dir_entry_struct* dir_entry);
 uint8_t fat_reset_dir(struct fat_dir_struct* dd);
+void fat_get_dir_pos(const struct fat_dir_struct* dd, struct fat_dir_pos_struct* pos);
+uint8_t fat_set_dir_pos(struct fat_dir_struct* dd, const struct fat_dir_pos_struct* pos);
 
 uint8_t fat_create_file(struct fat_dir_struct* parent, const char* file, struct fat_dir_entry_struct* dir_entry);
 uint8_t fat_delete_file(struct fat_fs_struct* fs, struct fat_dir_entry_struct* dir_entry);
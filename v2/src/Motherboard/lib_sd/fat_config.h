@@ -110,6 +110,17 @@ void get_datetime(uint16_t* year, uint8_t* month, uint8_t* day, uint8_t* hour, u
  */
 #define FAT_DIR_COUNT 2
 
+/**
+ * \ingroup fat_config
+ * Number of contiguous cluster runs cached per open file.
+ *
+ * Each file handle remembers the first runs of its cluster chain as
+ * (start cluster, length) pairs, so that sequential reads and seeks
+ * within the cached part of the file need not read the FAT.
+ * Set to 0 to disable the cache.
+ */
+#define FAT_CLUSTER_RUN_COUNT 4
+
 /**
  * @}
  */
@@ -155,6 +155,11 @@ static uint8_t raw_block_written;
 #endif
 #endif
 
+#if SD_RAW_STREAM_READ
+/* address of the next block of the open multi-block read, or -1 if none */
+static offset_t stream_block_address = (offset_t) -1;
+#endif
+
 /* card type state */
 static uint8_t sd_raw_card_type;
 
@@ -182,6 +187,9 @@ uint8_t sd_raw_init()
     configure_pin_miso();
 
     unselect_card();
+#if SD_RAW_STREAM_READ
+    stream_block_address = (offset_t) -1;
+#endif
 
     /* initialize SPI with lowest frequency; max. 400kHz during identification mode of card */
     SPCR = (0 << SPIE) | /* SPI Interrupt Enable */
@@ -429,6 +437,54 @@ uint8_t sd_raw_send_command(uint8_t command, uint32_t arg)
     return response;
 }
 
+/**
+ * \ingroup sd_raw
+ * Stops an open multi-block read.
+ *
+ * Sequential reads leave the card streaming blocks.  This is done
+ * automatically before any other card access, but should also be
+ * called once sequential reading is finished, so that the card is
+ * released.
+ */
+void sd_raw_stop_stream()
+{
+#if SD_RAW_STREAM_READ
+    if(stream_block_address == (offset_t) -1)
+        return;
+    stream_block_address = (offset_t) -1;
+
+    if(!sd_raw_available())
+    {
+        /* card is gone, just release the bus */
+        unselect_card();
+        return;
+    }
+
+    /* send stop command; the card may be in the middle of a block */
+    sd_raw_send_byte(0x40 | CMD_STOP_TRANSMISSION);
+    sd_raw_send_byte(0x00);
+    sd_raw_send_byte(0x00);
+    sd_raw_send_byte(0x00);
+    sd_raw_send_byte(0x00);
+    sd_raw_send_byte(0xff);
+
+    /* skip the stuff byte, then wait for the response */
+    sd_raw_rec_byte();
+    for(uint8_t i = 0; i < 10; ++i)
+    {
+        if(!(sd_raw_rec_byte() & 0x80))
+            break;
+    }
+
+    /* wait while card is busy */
+    while(sd_raw_rec_byte() != 0xff);
+
+    /* deaddress card */
+    unselect_card();
+    sd_raw_rec_byte();
+#endif
+}
+
 /**
  * \ingroup sd_raw
  * Reads raw data from the card.
@@ -463,6 +519,34 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
                 return 0;
 #endif
 
+#if SD_RAW_STREAM_READ
+            uint8_t streaming = (block_address == stream_block_address);
+            if(!streaming)
+            {
+                sd_raw_stop_stream();
+
+                /* address card */
+                select_card();
+
+#if SD_RAW_SDHC
+                uint32_t card_address = (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block_address / 512 : block_address);
+#else
+                uint32_t card_address = block_address;
+#endif
+                /* a read of the block following the cached one is taken as
+                 * the start of sequential access, so keep the card sending
+                 * blocks until we ask for something else
+                 */
+                streaming = (raw_block_address != (offset_t) -1 && block_address == raw_block_address + 512);
+
+                /* send block request */
+                if(sd_raw_send_command(streaming ? CMD_READ_MULTIPLE_BLOCK : CMD_READ_SINGLE_BLOCK, card_address))
+                {
+                    unselect_card();
+                    return 0;
+                }
+            }
+#else
             /* address card */
             select_card();
 
@@ -476,6 +560,7 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
                 unselect_card();
                 return 0;
             }
+#endif
 
             /* wait for data block (start byte 0xfe) */
             while(sd_raw_rec_byte() != 0xfe);
@@ -504,11 +589,21 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
             sd_raw_rec_byte();
             sd_raw_rec_byte();
             
-            /* deaddress card */
-            unselect_card();
+#if SD_RAW_STREAM_READ
+            if(streaming)
+            {
+                /* leave the card addressed; it is already sending the next block */
+                stream_block_address = block_address + 512;
+            }
+            else
+#endif
+            {
+                /* deaddress card */
+                unselect_card();
 
-            /* let card some time to finish */
-            sd_raw_rec_byte();
+                /* let card some time to finish */
+                sd_raw_rec_byte();
+            }
         }
 #if !SD_RAW_SAVE_RAM
         else
@@ -710,6 +805,10 @@ uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length)
 #endif
         }
 
+#if SD_RAW_STREAM_READ
+        sd_raw_stop_stream();
+#endif
+
         /* address card */
         select_card();
 
@@ -855,6 +954,9 @@ uint8_t sd_raw_get_info(struct sd_raw_info* info)
 
     memset(info, 0, sizeof(*info));
 
+#if SD_RAW_STREAM_READ
+    sd_raw_stop_stream();
+#endif
     select_card();
 
     /* read cid register */
@@ -59,6 +59,20 @@ extern "C"
  */
 #define SD_RAW_SAVE_RAM 1
 
+/**
+ * \ingroup sd_raw_config
+ * Controls multi-block streaming reads.
+ *
+ * Set to 1 to read sequentially accessed blocks with a single
+ * open-ended multi-block read (CMD18) instead of one command per
+ * block.  The stream is stopped with CMD12 on the next non-sequential
+ * access or other card operation.
+ *
+ * \note When SD_RAW_SAVE_RAM is 1, SD_RAW_STREAM_READ will
+ *       be reset to 0.
+ */
+#define SD_RAW_STREAM_READ 1
+
 /**
  * \ingroup sd_raw_config
  * Controls support for SDHC cards.
@@ -133,6 +147,10 @@ extern "C"
 #undef SD_RAW_WRITE_BUFFERING
 #define SD_RAW_WRITE_BUFFERING 0
 #endif
+#if SD_RAW_SAVE_RAM
+#undef SD_RAW_STREAM_READ
+#define SD_RAW_STREAM_READ 0
+#endif
 
 #ifdef __cplusplus
 }
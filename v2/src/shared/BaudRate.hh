@@ -0,0 +1,56 @@
+/*
+ * Copyright 2010 by Adam Mayer	 <adam@makerbot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef SHARED_BAUD_RATE_HH_
+#define SHARED_BAUD_RATE_HH_
+
+#include <stdint.h>
+
+/// Serial bit rates that a UART can be switched to at runtime.  These
+/// codes are sent over the wire in rate negotiation commands, so existing
+/// entries must never be renumbered.
+namespace BaudRate {
+enum {
+	BAUD_38400   = 0,
+	BAUD_57600   = 1,
+	BAUD_115200  = 2,
+	BAUD_250000  = 3,
+	BAUD_500000  = 4,
+	BAUD_1000000 = 5,
+	COUNT
+};
+}
+
+/// Return the bit rate in bits per second for the given rate code.
+inline uint32_t baudRateToBps(uint8_t rate) {
+	switch (rate) {
+	case BaudRate::BAUD_57600:   return 57600L;
+	case BaudRate::BAUD_115200:  return 115200L;
+	case BaudRate::BAUD_250000:  return 250000L;
+	case BaudRate::BAUD_500000:  return 500000L;
+	case BaudRate::BAUD_1000000: return 1000000L;
+	}
+	return 38400L;
+}
+
+/// Return the UBRR value that yields the given rate when the UART runs in
+/// double speed (U2Xn) mode.  The divisor is rounded to the nearest integer.
+inline uint16_t baudRateToUbrr(uint8_t rate) {
+	return ((F_CPU / 4) / baudRateToBps(rate) - 1) / 2;
+}
+
+#endif // SHARED_BAUD_RATE_HH_
@@ -20,6 +20,7 @@
 #define SHARED_CIRCULAR_BUFFER_HH_
 
 #include <stdint.h>
+#include <string.h>
 
 typedef uint16_t BufSizeType;
 
@@ -62,6 +63,21 @@ public:
 			overflow = true;
 		}
 	}
+	/// Append a run of bytes to the tail of the buffer, copying at most
+	/// two contiguous regions.  If there is not enough room for all of
+	/// them, push what we can and set the overflow flag.
+	inline void push(const BufDataType* src, BufSizeType sz) {
+		if (sz > size - length) {
+			overflow = true;
+			sz = size - length;
+		}
+		BufSizeType tail = (start + length) % size;
+		BufSizeType run = size - tail;
+		if (run > sz) { run = sz; }
+		memcpy(data + tail, src, run * sizeof(BufDataType));
+		memcpy(data, src + run, (sz - run) * sizeof(BufDataType));
+		length += sz;
+	}
 	/// Pop a byte off the head of the buffer
 	inline BufDataType pop() {
 		if (isEmpty()) {
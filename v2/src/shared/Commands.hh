@@ -61,6 +61,30 @@
 
 #define HOST_CMD_GET_POSITION_EXT  21
 #define HOST_CMD_EXTENDED_STOP     22
+// Retrieve RS485 link statistics for a toolhead
+#define HOST_CMD_GET_TOOL_LINK_STATS 23
+// Switch the host UART to another bit rate (see BaudRate.hh).  The response
+// is sent at the old rate; the host must then send a packet at the new rate
+// within a second, or the board reverts to the old rate.
+#define HOST_CMD_SET_BAUD_RATE     24
+// Like HOST_CMD_NEXT_FILENAME, but returns as many names as fit in the
+// response; an empty name marks the end of the listing.
+#define HOST_CMD_GET_NEXT_FILENAMES 25
+// Indexed build files: read the header, read a seek index entry, and
+// start playback from a seek index entry.
+#define HOST_CMD_GET_BUILD_INFO    26
+#define HOST_CMD_GET_BUILD_INDEX   27
+#define HOST_CMD_PLAYBACK_FROM_INDEX 28
+// Resume the SD build saved by the last checkpoint
+#define HOST_CMD_RESUME_PLAYBACK   29
+// Report the progress and queue statistics of the SD card playback
+#define HOST_CMD_GET_PLAYBACK_STATUS 30
+// Play the builds listed in a playlist file on the SD card
+#define HOST_CMD_PLAY_PLAYLIST     31
+// Like HOST_CMD_CAPTURE_TO_FILE, but the captured commands are also run
+#define HOST_CMD_TEE_TO_FILE       32
+// Set the speed of moves, as a percentage of the speed they ask for
+#define HOST_CMD_SET_SPEED_OVERRIDE 33
 
 // These are our bufferable commands from the host
 // #define HOST_CMD_QUEUE_POINT_INC   128  // deprecated
@@ -119,5 +143,19 @@
 #define SLAVE_CMD_GET_BUILD_NAME        34
 #define SLAVE_CMD_IS_PLATFORM_READY     35
 #define SLAVE_CMD_GET_TOOL_STATUS       36
+// Switch the RS485 link to another bit rate (see BaudRate.hh).  The tool
+// answers at the old rate and falls back to 38400 unless it hears a valid
+// packet at the new rate shortly afterwards.
+#define SLAVE_CMD_SET_BAUD_RATE         37
+// Tune the PID gains of a heater (0: extruder, 1: platform) around the given
+// temperature, and save them to EEPROM.  Poll SLAVE_CMD_GET_AUTOTUNE_STATUS
+// for the outcome.
+#define SLAVE_CMD_AUTOTUNE_PID          38
+// State of the last autotune (idle, running, done, failed) and the gains
+// it found, in 8.8 fixed point
+#define SLAVE_CMD_GET_AUTOTUNE_STATUS   39
+// Samples of the heaters' temperature, set point, output and PID terms,
+// from the given sample number on, as many as fit (see Telemetry.hh)
+#define SLAVE_CMD_GET_TELEMETRY         40
 
 #endif // SHARED_COMMANDS_H_
@@ -30,6 +30,9 @@
 // scale the output term to account for our fixed-point bounds
 #define OUTPUT_SCALE 2
 
+// Largest sum of the terms, in 8.8 fixed point, whose output fits in an int
+#define TERM_SUM_MAX ((0x7fffL / OUTPUT_SCALE) << 8)
+
 void PID::reset() {
 	sp = 0;
 	p_gain = i_gain = d_gain = 0;
@@ -70,20 +73,29 @@ int PID::calculate(const int pv) {
 	if (error_acc < ERR_ACC_MIN) {
 		error_acc = ERR_ACC_MIN;
 	}
-	float p_term = (float)e * p_gain;
-	float i_term = (float)error_acc * i_gain;
+	// The terms are 8.8 fixed point, like the gains.
+	int32_t p_term = (int32_t)e * p_gain;
+	int32_t i_term = (int32_t)error_acc * i_gain;
 	int delta = e - prev_error;
 	// Add to delta history
 	delta_summation -= delta_history[delta_idx];
 	delta_history[delta_idx] = delta;
-	delta_summation += (float)delta;
+	delta_summation += delta;
 	delta_idx = (delta_idx+1) % DELTA_SAMPLES;
 	// Use the delta over the whole window
-	float d_term = delta_summation * d_gain;
+	int32_t d_term = (int32_t)delta_summation * d_gain;
 
 	prev_error = e;
 
-	last_output = ((int)(p_term + i_term + d_term))*OUTPUT_SCALE;
+	int32_t sum = p_term + i_term + d_term;
+	if (sum > TERM_SUM_MAX) {
+		sum = TERM_SUM_MAX;
+	} else if (sum < -TERM_SUM_MAX) {
+		sum = -TERM_SUM_MAX;
+	}
+	// Divide rather than shift, so that the fraction is dropped towards
+	// zero.
+	last_output = ((int)(sum / 256))*OUTPUT_SCALE;
 
 	return last_output;
 }
@@ -100,7 +112,7 @@ int PID::getErrorTerm() {
 }
 
 int PID::getDeltaTerm() {
-	return (int)delta_summation;
+	return delta_summation;
 }
 
 int PID::getLastOutput() {
@@ -28,18 +28,25 @@
 
 #define DELTA_SAMPLES 4
 
+/// Gains are unsigned 8.8 fixed-point values, as stored in the EEPROM:
+/// the high byte is the integer part and the low byte the fraction.
+/// PID_FIXED converts a constant at compile time.
+#define PID_FIXED(x) ((uint16_t)((x)*256.0 + 0.5))
+
 /// This simplified PID controller makes several assumptions:
 /// * The output range is limited to 0-255.
+/// All of the arithmetic is done in integers; the AVRs have no floating
+/// point hardware.
 class PID {
 private:
-    float p_gain; // proportional gain
-    float i_gain; // integral gain
-    float d_gain; // derivative gain
+    uint16_t p_gain; // proportional gain
+    uint16_t i_gain; // integral gain
+    uint16_t d_gain; // derivative gain
 
     // Data for approximating d (smoothing to handle discrete nature of sampling).
     // See PID.cc for a description of why we do this.
     int16_t delta_history[DELTA_SAMPLES];
-    float delta_summation;
+    int16_t delta_summation;
     uint8_t delta_idx;
     int prev_error; // previous input for calculating next delta
     int error_acc;  // accumulated error, for calculating integral
@@ -50,9 +57,9 @@ private:
 
 public:
     PID() { reset(); }
-    void setPGain(const float p_gain_in) { p_gain = p_gain_in; }
-    void setIGain(const float i_gain_in) { i_gain = i_gain_in; }
-    void setDGain(const float d_gain_in) { d_gain = d_gain_in; }
+    void setPGain(const uint16_t p_gain_in) { p_gain = p_gain_in; }
+    void setIGain(const uint16_t i_gain_in) { i_gain = i_gain_in; }
+    void setDGain(const uint16_t d_gain_in) { d_gain = d_gain_in; }
 
     void setTarget(const int target);
     const int getTarget() const { return sp; }
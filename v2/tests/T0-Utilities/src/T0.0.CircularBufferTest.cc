@@ -98,3 +98,37 @@ TEST(CircularBufferTest,UnderflowCheck) {
         ASSERT_FALSE(cb.hasUnderflow());
     }
 }
+
+TEST(CircularBufferTest,BulkPush) {
+    DEFINE_BUFFER(cb,uint8_t,buffer_size);
+    uint8_t src[buffer_size+1];
+    for (int i = 0; i < buffer_size+1; i++) {
+        src[i] = i;
+    }
+    // Push runs of every length at every start offset, so that the copy
+    // wraps around the end of the buffer at every point.
+    for (int offset = 0; offset < buffer_size; offset++) {
+        for (int run = 0; run <= buffer_size; run++) {
+            cb.reset();
+            for (int i = 0; i < offset; i++) {
+                cb.push(0xff);
+                cb.pop();
+            }
+            cb.push(src,run);
+            ASSERT_EQ(cb.getLength(),run);
+            for (int i = 0; i < run; i++) {
+                ASSERT_EQ(cb.pop(),i);
+            }
+            ASSERT_FALSE(cb.hasOverflow());
+        }
+        // Pushing more than fits fills the buffer and flags the overflow.
+        cb.push(0xff);
+        cb.push(src,buffer_size);
+        ASSERT_TRUE(cb.hasOverflow());
+        ASSERT_EQ(cb.getLength(),buffer_size);
+        ASSERT_EQ(cb.pop(),0xff);
+        for (int i = 0; i < buffer_size-1; i++) {
+            ASSERT_EQ(cb.pop(),i);
+        }
+    }
+}
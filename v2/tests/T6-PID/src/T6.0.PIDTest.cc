@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <time.h>
+#include "PID.hh"
+
+/// The floating point PID that PID replaced, kept to check the fixed-point
+/// version against.
+class FloatPID {
+	float p_gain, i_gain, d_gain;
+	int16_t delta_history[DELTA_SAMPLES];
+	float delta_summation;
+	uint8_t delta_idx;
+	int prev_error;
+	int error_acc;
+	int sp;
+public:
+	FloatPID(float p, float i, float d) : p_gain(p), i_gain(i), d_gain(d),
+			delta_summation(0), delta_idx(0), prev_error(0), error_acc(0), sp(0) {
+		for (int j = 0; j < DELTA_SAMPLES; j++) { delta_history[j] = 0; }
+	}
+	void setTarget(int target) { sp = target; }
+	int calculate(int pv) {
+		int e = sp - pv;
+		error_acc += e;
+		if (error_acc > 256) { error_acc = 256; }
+		if (error_acc < -256) { error_acc = -256; }
+		float p_term = (float)e * p_gain;
+		float i_term = (float)error_acc * i_gain;
+		int delta = e - prev_error;
+		delta_summation -= delta_history[delta_idx];
+		delta_history[delta_idx] = delta;
+		delta_summation += (float)delta;
+		delta_idx = (delta_idx+1) % DELTA_SAMPLES;
+		float d_term = delta_summation * d_gain;
+		prev_error = e;
+		// The AVR's ints are 16 bits; the fixed-point version saturates
+		// where this used to overflow.
+		float sum = p_term + i_term + d_term;
+		if (sum > 16383) { sum = 16383; }
+		if (sum < -16383) { sum = -16383; }
+		return ((int)sum)*2;
+	}
+};
+
+struct Gains {
+	uint16_t p, i, d;
+};
+
+// The defaults for the extruder, and some other plausible settings.
+const Gains gains[] = {
+	{ PID_FIXED(7.0), PID_FIXED(0.325), PID_FIXED(36.0) },
+	{ PID_FIXED(10.5), PID_FIXED(0.05), PID_FIXED(12.25) },
+	{ PID_FIXED(2.0), PID_FIXED(1.5), PID_FIXED(0) },
+	{ PID_FIXED(255.0), PID_FIXED(0.00390625), PID_FIXED(100.0) },
+};
+const int gain_count = sizeof(gains)/sizeof(gains[0]);
+
+/// A crude heater model: the temperature moves towards a level set by the
+/// output, with some sensor noise.
+class Plant {
+	int32_t temp; // in 1/16 degree
+	uint32_t seed;
+public:
+	Plant(int start, uint32_t seed_in) : temp(start*16), seed(seed_in) {}
+	int read() {
+		seed = seed * 1103515245 + 12345;
+		return temp/16 + (int)((seed >> 16) % 3) - 1;
+	}
+	void apply(int output) {
+		if (output < 0) { output = 0; }
+		if (output > 255) { output = 255; }
+		temp += (output * 3 - (temp/16 - 20) * 2) / 2;
+	}
+};
+
+/// Run both controllers over heat-up, hold and set point change traces,
+/// feeding the plant from the fixed-point output.
+TEST(PIDTest, MatchesFloat) {
+	const int targets[] = { 220, 110, 0, 240 };
+	for (int g = 0; g < gain_count; g++) {
+		PID pid;
+		pid.setPGain(gains[g].p);
+		pid.setIGain(gains[g].i);
+		pid.setDGain(gains[g].d);
+		FloatPID ref(gains[g].p/256.0, gains[g].i/256.0, gains[g].d/256.0);
+		Plant plant(25, g);
+		for (int t = 0; t < 4; t++) {
+			pid.setTarget(targets[t]);
+			// The PID resets its state when the target changes.
+			ref = FloatPID(gains[g].p/256.0, gains[g].i/256.0, gains[g].d/256.0);
+			ref.setTarget(targets[t]);
+			for (int step = 0; step < 2000; step++) {
+				const int pv = plant.read();
+				const int out = pid.calculate(pv);
+				ASSERT_EQ(ref.calculate(pv), out) << "gains " << g <<
+						", target " << targets[t] << ", step " << step;
+				ASSERT_EQ(out, pid.getLastOutput());
+				plant.apply(out);
+			}
+		}
+	}
+}
+
+TEST(PIDTest, Extremes) {
+	PID pid;
+	pid.setPGain(PID_FIXED(255.99));
+	pid.setIGain(PID_FIXED(255.99));
+	pid.setDGain(PID_FIXED(255.99));
+	pid.setTarget(1000);
+	// Saturates rather than wrapping around.
+	ASSERT_GT(pid.calculate(-1000), 0);
+	pid.setTarget(-1000);
+	ASSERT_LT(pid.calculate(1000), 0);
+	// The integral term is clamped.
+	pid.reset();
+	pid.setIGain(PID_FIXED(1.0));
+	pid.setTarget(100);
+	for (int i = 0; i < 100; i++) {
+		pid.calculate(0);
+	}
+	ASSERT_EQ(256, pid.getErrorTerm());
+	ASSERT_EQ(512, pid.calculate(100));
+}
+
+/// Not a test as such; reports the relative cost of the two versions on
+/// the host.  The gap is far wider on an AVR, which has no FPU.
+TEST(PIDTest, Benchmark) {
+	const int rounds = 2000000;
+	PID pid;
+	pid.setPGain(gains[0].p);
+	pid.setIGain(gains[0].i);
+	pid.setDGain(gains[0].d);
+	pid.setTarget(220);
+	FloatPID ref(gains[0].p/256.0, gains[0].i/256.0, gains[0].d/256.0);
+	ref.setTarget(220);
+	volatile int sink = 0;
+	clock_t start = clock();
+	for (int i = 0; i < rounds; i++) {
+		sink += pid.calculate(200 + (i & 31));
+	}
+	const clock_t fixed_ticks = clock() - start;
+	start = clock();
+	for (int i = 0; i < rounds; i++) {
+		sink += ref.calculate(200 + (i & 31));
+	}
+	const clock_t float_ticks = clock() - start;
+	printf("%d rounds: fixed point %.3fs, float %.3fs\n", rounds,
+			(double)fixed_ticks/CLOCKS_PER_SEC, (double)float_ticks/CLOCKS_PER_SEC);
+}
@@ -0,0 +1,176 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <vector>
+#include "BuildCodec.hh"
+#include "Commands.hh"
+
+typedef std::vector<uint8_t> Command;
+
+OutPacket& toPacket(const Command& command) {
+	static OutPacket packet;
+	packet.reset();
+	for (size_t i = 0; i < command.size(); i++) {
+		packet.append8(command[i]);
+	}
+	return packet;
+}
+
+Command literal(uint8_t length, uint8_t fill) {
+	Command command(length, fill);
+	command[0] = HOST_CMD_TOOL_COMMAND;
+	return command;
+}
+
+Command move(int32_t x, int32_t y, int32_t z, uint32_t dda) {
+	Command command;
+	command.push_back(HOST_CMD_QUEUE_POINT_EXT);
+	const int32_t values[6] = { x, y, z, 0, 0, (int32_t)dda };
+	for (int i = 0; i < 6; i++) {
+		for (int j = 0; j < 4; j++) {
+			command.push_back((values[i] >> (8*j)) & 0xff);
+		}
+	}
+	return command;
+}
+
+typedef std::vector<uint8_t> Block;
+
+/// Packs commands into blocks with BuildBlockPacker, writing out each
+/// block as SDCard.cc's capturePacket() does.  In tee mode a closed block
+/// is written out at once.
+std::vector<Block> writeBlocks(const std::vector<Command>& commands, bool tee) {
+	std::vector<Block> blocks;
+	uint8_t buffer[BUILD_BLOCK_DATA];
+	BuildBlockPacker packer(buffer);
+	packer.reset(tee);
+	uint32_t offset = 0;
+	for (size_t i = 0; i < commands.size(); i++) {
+		const OutPacket& packet = toPacket(commands[i]);
+		if (!packer.add(packet, offset)) {
+			EXPECT_TRUE(packer.isClosed());
+			blocks.push_back(Block(buffer, buffer + packer.getLength()));
+			packer.clear();
+			EXPECT_TRUE(packer.add(packet, offset));
+		}
+		offset += commands[i].size();
+		if (tee && packer.isClosed()) {
+			blocks.push_back(Block(buffer, buffer + packer.getLength()));
+			packer.clear();
+		}
+	}
+	if (packer.getLength() != 0) {
+		blocks.push_back(Block(buffer, buffer + packer.getLength()));
+	}
+	return blocks;
+}
+
+/// Decodes blocks the way SDCard.cc's fillPlaybackBuffer() does, counting
+/// the blocks that end in a single byte of padding.
+std::vector<Command> readBlocks(const std::vector<Block>& blocks,
+		int& one_byte_tails) {
+	std::vector<Command> commands;
+	BuildDecoder decoder;
+	uint8_t command[BUILD_MAX_COMMAND];
+	one_byte_tails = 0;
+	for (size_t b = 0; b < blocks.size(); b++) {
+		const Block& block = blocks[b];
+		decoder.reset();
+		uint16_t index = sizeof(uint32_t);
+		while (index < block.size()) {
+			uint8_t length;
+			const uint8_t used = decoder.decode(&block[index],
+					block.size() - index, command, length);
+			EXPECT_NE(0, used) << "block " << b << " offset " << index;
+			if (used == 0) {
+				return commands;
+			}
+			if (length == 0 && block.size() - index == 1) {
+				one_byte_tails++;
+			}
+			index += used;
+			if (length == 0) {
+				break;
+			}
+			commands.push_back(Command(command, command + length));
+		}
+	}
+	return commands;
+}
+
+TEST(BuildCodecTest, OneBytePadding) {
+	// Literals of 2+n bytes, filling the block but for one byte
+	std::vector<Command> commands;
+	uint16_t used = sizeof(uint32_t);
+	while (BUILD_BLOCK_DATA - used - 1 > 32 + 2) {
+		commands.push_back(literal(32, 0x55));
+		used += 34;
+	}
+	commands.push_back(literal(BUILD_BLOCK_DATA - used - 1 - 2, 0x66));
+	commands.push_back(literal(10, 0x77));
+	const std::vector<Block> blocks = writeBlocks(commands, false);
+	ASSERT_EQ(2u, blocks.size());
+	EXPECT_EQ((size_t)BUILD_BLOCK_DATA, blocks[0].size());
+	int one_byte_tails;
+	const std::vector<Command> decoded = readBlocks(blocks, one_byte_tails);
+	EXPECT_EQ(1, one_byte_tails);
+	EXPECT_TRUE(decoded == commands);
+}
+
+TEST(BuildCodecTest, OneBytePaddingTee) {
+	// In tee mode the block is closed once a longest token might not fit,
+	// which leaves one byte when a 33 byte token ends it.
+	std::vector<Command> commands;
+	uint16_t used = sizeof(uint32_t);
+	while (used + 34 + 33 <= BUILD_BLOCK_DATA - 1) {
+		commands.push_back(literal(32, 0x55));
+		used += 34;
+	}
+	commands.push_back(literal(BUILD_BLOCK_DATA - 1 - 33 - used - 2, 0x66));
+	commands.push_back(literal(31, 0x77));
+	commands.push_back(literal(10, 0x88));
+	const std::vector<Block> blocks = writeBlocks(commands, true);
+	ASSERT_EQ(2u, blocks.size());
+	EXPECT_EQ((size_t)BUILD_BLOCK_DATA, blocks[0].size());
+	int one_byte_tails;
+	const std::vector<Command> decoded = readBlocks(blocks, one_byte_tails);
+	EXPECT_EQ(1, one_byte_tails);
+	EXPECT_TRUE(decoded == commands);
+}
+
+void roundTrip(bool tee) {
+	std::vector<Command> commands;
+	int32_t x = 0, y = 0, z = 0;
+	uint32_t seed = 12345;
+	for (int i = 0; i < 20000; i++) {
+		seed = seed * 1103515245 + 12345;
+		const uint32_t r = seed >> 8;
+		if (r % 5 == 0) {
+			commands.push_back(literal(2 + (r >> 8) % 31, r & 0xff));
+		} else {
+			x += (int32_t)((r >> 4) % 4001) - 2000;
+			if (r & 1) { y += (int32_t)((r >> 12) % 801) - 400; }
+			if (r % 13 == 0) { z += 100; }
+			commands.push_back(move(x, y, z, 500 + (r >> 20) % 3));
+		}
+	}
+	const std::vector<Block> blocks = writeBlocks(commands, tee);
+	for (size_t b = 0; b + 1 < blocks.size(); b++) {
+		EXPECT_EQ((size_t)BUILD_BLOCK_DATA, blocks[b].size());
+	}
+	int one_byte_tails;
+	const std::vector<Command> decoded = readBlocks(blocks, one_byte_tails);
+	// Tee blocks only end in one byte after a longest token; see above.
+	if (!tee) {
+		EXPECT_LT(0, one_byte_tails);
+	}
+	ASSERT_EQ(commands.size(), decoded.size());
+	EXPECT_TRUE(decoded == commands);
+}
+
+TEST(BuildCodecTest, RoundTrip) {
+	roundTrip(false);
+}
+
+TEST(BuildCodecTest, RoundTripTee) {
+	roundTrip(true);
+}
@@ -0,0 +1,32 @@
+// Host stand-in for the avr-libc header, for building Packet.cc in tests.
+// These are the reference implementations from the avr-libc manual.
+#ifndef UTIL_CRC16_H_
+#define UTIL_CRC16_H_
+
+#include <stdint.h>
+
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t a) {
+	crc ^= a;
+	for (int i = 0; i < 8; ++i) {
+		if (crc & 1) {
+			crc = (crc >> 1) ^ 0xA001;
+		} else {
+			crc = (crc >> 1);
+		}
+	}
+	return crc;
+}
+
+static inline uint8_t _crc_ibutton_update(uint8_t crc, uint8_t data) {
+	crc = crc ^ data;
+	for (uint8_t i = 0; i < 8; i++) {
+		if (crc & 0x01) {
+			crc = (crc >> 1) ^ 0x8C;
+		} else {
+			crc >>= 1;
+		}
+	}
+	return crc;
+}
+
+#endif // UTIL_CRC16_H_